@@ -1,616 +1,347 @@
-#include <fcntl.h>
-#include <getopt.h>
-#include <sndfile.h>
-#include <stdio.h>
+#include <sys/types.h>
+
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/soundcard.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <unistd.h>
 
-#include "audio.h"
 #include "libmsr.h"
+#include "audio.h"
 
-
-/********** function wrappers **********/
-/* allocate memory with out of memory checking
-   [size]          allocate size bytes
-   returns         pointer to allocated memory */
-void *msr_malloc(size_t size)
-{
-  void *ptr;
-
-  ptr = malloc(size);
-  if (ptr == NULL) {
-    fprintf(stderr, "Out of memory.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  return ptr;
-}
-
-
-/* reallocate memory with out of memory checking
-   [ptr]           memory to reallocate
-   [size]          allocate size bytes
-   returns         pointer to reallocated memory */
-void *msr_realloc(void *ptr, size_t size)
+/*
+ * Swipe decoding from audio.
+ *
+ * This was a copy of dab's decoder that kept the recording in file
+ * scope globals and printed bits on stdout as it found them, so it
+ * could only ever decode one swipe at a time, in one place. Now the
+ * state of a head lives in its own msr_audio_t: the streaming bit
+ * decoder, where we are in the swipe, and the swipe's bits, packed.
+ *
+ * Samples are handled a chunk at a time, however the caller's input
+ * is cut up. A swipe starts at the first sample above the silence
+ * threshold and ends once MSR_AUDIO_END_MS of samples have gone by
+ * without one, as msr_segment finds them.
+ */
+
+/* Bits decoded at a time, before packing. */
+#define MSR_AUDIO_CHUNK		1024
+
+int
+msr_audio_init (msr_audio_t * au, int rate, int thres, int freq_thres)
 {
-  void *nptr;
+	memset (au, 0, sizeof (msr_audio_t));
+	if (rate < 1 || thres < 0)
+		return (-1);
 
-  nptr = realloc(ptr, size);
-  if (nptr == NULL) {
-    fprintf(stderr, "Out of memory.\n");
-    exit(EXIT_FAILURE);
-  }
+	msr_biphase_init (&au->msr_au_bp, thres, freq_thres);
+	msr_segment_init (&au->msr_au_seg, thres, 1,
+	    (long)rate * MSR_AUDIO_END_MS / 1000);
 
-  return nptr;
+	return (0);
 }
 
-
-/* copy a string with out of memory checking
-   [string]         string to copy
-   returns          newly allocated copy of string */
-char *msr_strdup(char *string)
+void
+msr_audio_free (msr_audio_t * au)
 {
-  char *ptr;
-
-  ptr = msr_malloc(strlen(string) + 1);
-  strcpy(ptr, string);
-
-  return ptr;
+	free (au->msr_au_bits);
+	au->msr_au_bits = NULL;
+	au->msr_au_size = 0;
+	au->msr_au_nbits = 0;
+
+	if (au->msr_au_ml) {
+		msr_peaks_free (&au->msr_au_peaks);
+		msr_viterbi_free (&au->msr_au_vt);
+	}
+	free (au->msr_au_chars);
+	au->msr_au_chars = NULL;
+	au->msr_au_nchars = 0;
 }
 
+/*
+ * Decide on the bits of each swipe by maximum likelihood if <on>, with
+ * characters of <bpc> bits (5 or 7, or 0 if not known) expected to
+ * pass their parity check, or as the swipe goes by if not. The peak
+ * intervals of the swipe are kept, and msr_viterbi_decode() is run
+ * over them when it ends.
+ */
 
-/* read with error checking
-   [fd]            file descriptor to read from
-   [buf]           buffer
-   [count]         bytes to read
-   returns         bytes read */
-ssize_t msr_read(int fd, void *buf, size_t count)
+void
+msr_audio_viterbi (msr_audio_t * au, int on, int bpc)
 {
-  int retval;
-
-  retval = read(fd, buf, count);
-  if (retval == -1) {
-    perror("read()");
-    exit(EXIT_FAILURE);
-  }
-
-  return retval;
+	if (au->msr_au_ml && !on) {
+		msr_peaks_free (&au->msr_au_peaks);
+		msr_viterbi_free (&au->msr_au_vt);
+	} else if (!au->msr_au_ml && on) {
+		msr_peaks_init (&au->msr_au_peaks);
+		msr_viterbi_init (&au->msr_au_vt);
+	}
+
+	au->msr_au_ml = on;
+	au->msr_au_bpc = bpc;
+	msr_biphase_keep (&au->msr_au_bp, on ? &au->msr_au_peaks : NULL);
 }
 
-/********** end function wrappers **********/
-
-
-/********** string functions **********/
-/* returns a pointer to the reversed string
-   [string]        string to reverse
-   returns         newly allocated reversed string */
-char *msr_reverse_string(char *string)
+/* Pack <n> '0' and '1' characters onto the end of the swipe's bits. */
+static int
+append (msr_audio_t * au, const char * bits, int n)
 {
-  char *rstring;
-  int i, string_len;
-
-  string_len = strlen(string); /* record string length */
-
-  /* allocate memory for rstring */
-  rstring = msr_malloc(string_len + 1);
-
-  for (i = 0; i < string_len; i++) /* reverse string and store in rstring */
-    rstring[i] = string[string_len - i - 1];
-
-  rstring[string_len] = '\0'; /* terminate rstring */
-
-  return rstring; /* return rstring */
+	uint8_t * p;
+	long size, i;
+	int j;
+
+	size = (au->msr_au_nbits + n + 7) / 8;
+	if (size > au->msr_au_size) {
+		if (size < au->msr_au_size * 2)
+			size = au->msr_au_size * 2;
+		p = realloc (au->msr_au_bits, size);
+		if (p == NULL)
+			return (-1);
+		memset (p + au->msr_au_size, 0, size - au->msr_au_size);
+		au->msr_au_bits = p;
+		au->msr_au_size = size;
+		au->msr_au_allocs++;
+	}
+
+	for (j = 0; j < n; j++) {
+		i = au->msr_au_nbits++;
+		if (bits[j] == '1')
+			au->msr_au_bits[i / 8] |= 0x80 >> (i % 8);
+	}
+
+	return (0);
 }
-/********** end string functions **********/
 
+/*
+ * Decode <count> samples of the swipe. When the bits are to be decided
+ * on at the end, only the peak intervals are wanted from here.
+ */
 
-/********** parsing functions **********/
-/* parse ABA format raw bits and return a pointer to the decoded string
-   [bitstring]     string to decode
-   returns         decoded string */
-char *msr_parse_ABA(char *bitstring)
+static int
+decode (msr_audio_t * au, const int16_t * samples, int count)
 {
-  char *decoded_string, *lrc_start, *start_decode, *string;
-  char lrc[] = {1, 1, 0, 1, 0}; /* initial condition is LRC of the start
-                                   sentinel */
-  int asciichr, charcnt = 0, i, j;
-
-  /* make a copy of bitstring and store it in string */
-  string = msr_strdup(bitstring);
-
-  /* look for start sentinel */
-  if ((start_decode = strstr(string, "11010")) == NULL) {
-    free(string); /* free string memory */
-    return NULL; /* could not find start sentinel */
-  }
-
-  /* set start_decode to first bit (start of first byte) after start
-     sentinel */
-  start_decode += 5;
-
-  /* look for end sentinel */
-  if ((lrc_start = strstr(string, "11111")) == NULL) {
-    free(string); /* free string memory */
-    return NULL; /* could not find end sentinel */
-  }
-  /* must be a multiple of 5 */
-  while ((strlen(start_decode) - strlen(lrc_start)) % 5) /* search again */
-    if ((lrc_start = strstr(++lrc_start, "11111")) == NULL) {
-      free(string); /* free string memory */
-      return NULL; /* could not find end sentinel */
-    }
-
-  lrc_start[0] = '\0'; /* terminate start_decode at end sentinel */
-
-  lrc_start += 5; /* set the pointer to the LRC */
-  if (lrc_start[5] != '\0') /* terminate LRC if not already */
-    lrc_start[5] = '\0';
-
-  /* allocate memory for decoded_string */
-  decoded_string = msr_malloc((strlen(start_decode) / 5) + 3);
-
-  decoded_string[charcnt++] = ';'; /* add start sentinel */
-
-  /* decode each set of bits, check parity, check LRC, and add to
-     decoded_string */
-  while (strlen(start_decode)) {
-
-    for (i = 0, j = 0; i < 4; i++) /* check parity */
-      if (start_decode[i] == '1')
-        j++;
-    if (((j % 2) && start_decode[4] == '1') ||
-        (!(j % 2) && start_decode[4] == '0')) {
-      free(string); /* free string memory */
-      free(decoded_string); /* free decoded_string memory */
-      return NULL; /* failed parity check */
-    }
-
-    asciichr = 48; /* generate ascii value from bits */
-    asciichr += start_decode[0] == '1' ? 1 : 0;
-    asciichr += start_decode[1] == '1' ? 2 : 0;
-    asciichr += start_decode[2] == '1' ? 4 : 0;
-    asciichr += start_decode[3] == '1' ? 8 : 0;
-
-    decoded_string[charcnt++] = asciichr; /* add character to decoded_string */
-
-    for (i = 0; i < 4; i++) /* calculate LRC */
-      lrc[i] = lrc[i] ^ (start_decode[i] == '1') ? 1 : 0;
-
-    start_decode += 5; /* increment start_decode to next byte */
-  }
-
-  decoded_string[charcnt++] = '?'; /* add end sentinel */
-  decoded_string[charcnt] = '\0'; /* terminate decoded_string */
-
-  for (i = 0; i < 4; i++) /* calculate CRC of end sentinel */
-    lrc[i] = lrc[i] ^ 1;
-
-  for (i = 0, j = 0; i < 4; i++) /* set LRC parity bit */
-    if (lrc[i])
-      j++;
-  if (!(j % 2))
-    lrc[4] = 1;
-  else
-    lrc[4] = 0;
-
-  for (i = 0; i < 5; i++) /* check CRC */
-    if ((lrc[i] && lrc_start[i] == '0') ||
-        (!lrc[i] && lrc_start[i] == '1')) {
-      free(string); /* free string memory */
-      free(decoded_string); /* free decoded_string memory */
-      return NULL; /* failed CRC check */
-    }
-
-  free(string); /* free string memory */
-  return decoded_string;
+	char bits[MSR_AUDIO_CHUNK];
+	msr_peaks_t * pk = &au->msr_au_peaks;
+	long size = pk->msr_pk_size;
+	int i, n;
+
+	if (au->msr_au_ml) {
+		if (msr_peaks_reserve (pk, pk->msr_pk_count + count / 2 + 2)
+		    == -1)
+			return (-1);
+		if (pk->msr_pk_size != size)
+			au->msr_au_allocs++;
+	}
+
+	for (i = 0; i < count; i += MSR_AUDIO_CHUNK) {
+		n = msr_biphase_push (&au->msr_au_bp, samples + i,
+		    count - i < MSR_AUDIO_CHUNK ? count - i : MSR_AUDIO_CHUNK,
+		    bits);
+		if (!au->msr_au_ml && append (au, bits, n) == -1)
+			return (-1);
+	}
+
+	return (0);
 }
 
-
-/* parse IATA format raw bits and return a pointer to the decoded string
-   [bitstring]     string to decode
-   returns         decoded string */
-char *msr_parse_IATA(char *bitstring)
+/* Decide on the bits of the swipe from its peak intervals. */
+static int
+viterbi (msr_audio_t * au)
 {
-  char *decoded_string, *lrc_start, *start_decode, *string;
-  char lrc[] = {1, 0, 1, 0, 0, 0, 1}; /* initial condition is LRC of the start
-                                         sentinel */
-  int asciichr, charcnt = 0, i, j;
-
-  /* make a copy of bitstring and store it in string */
-  string = msr_strdup(bitstring);
-
-  /* look for start sentinel */
-  if ((start_decode = strstr(string, "1010001")) == NULL) {
-    free(string); /* free string memory */
-    return NULL; /* could not find start sentinel */
-  }
-
-  /* set start_decode to first bit (start of first byte) after start
-     sentinel */
-  start_decode += 7;
-
-  /* look for end sentinel */
-  if ((lrc_start = strstr(string, "1111100")) == NULL) {
-    free(string); /* free string memory */
-    return NULL; /* could not find end sentinel */
-  }
-  /* must be a multiple of 7 */
-  while ((strlen(start_decode) - strlen(lrc_start)) % 7)
-    /* search again */
-    if ((lrc_start = strstr(++lrc_start, "1111100")) == NULL) {
-      free(string); /* free string memory */
-      return NULL; /* could not find end sentinel */
-    }
-
-  lrc_start[0] = '\0'; /* terminate start_decode at end sentinel */
-
-  lrc_start += 7; /* set the pointer to the LRC */
-  if (lrc_start[7] != '\0') /* terminate LRC if not already */
-    lrc_start[7] = '\0';
-
-  /* allocate memory for decoded_string */
-  decoded_string = msr_malloc((strlen(start_decode) / 7) + 3);
-
-  decoded_string[charcnt++] = '%'; /* add start sentinel */
-
-  /* decode each set of bits, check parity, check LRC, and add to
-     decoded_string */
-  while (strlen(start_decode)) {
-
-    for (i = 0, j = 0; i < 6; i++) /* check parity */
-      if (start_decode[i] == '1')
-        j++;
-    if (((j % 2) && start_decode[6] == '1') ||
-        (!(j % 2) && start_decode[6] == '0')) {
-      free(string); /* free string memory */
-      free(decoded_string); /* free decoded_string memory */
-      return NULL; /* failed parity check */
-    }
-
-    asciichr = 32; /* generate ascii value from bits */
-    asciichr += start_decode[0] == '1' ? 1  : 0;
-    asciichr += start_decode[1] == '1' ? 2  : 0;
-    asciichr += start_decode[2] == '1' ? 4  : 0;
-    asciichr += start_decode[3] == '1' ? 8  : 0;
-    asciichr += start_decode[4] == '1' ? 16 : 0;
-    asciichr += start_decode[5] == '1' ? 32 : 0;
-
-    decoded_string[charcnt++] = asciichr; /* add character to decoded_string */
-
-    for (i = 0; i < 6; i++) /* calculate LRC */
-      lrc[i] = lrc[i] ^ (start_decode[i] == '1') ? 1 : 0;
-
-    start_decode += 7; /* increment start_decode to next byte */
-  }
-
-  decoded_string[charcnt++] = '?'; /* add end sentinel */
-  decoded_string[charcnt] = '\0'; /* terminate decoded_string */
-
-  for (i = 0; i < 5; i++) /* calculate CRC of end sentinel */
-    lrc[i] = lrc[i] ^ 1;
-  lrc[5] = lrc[5] ^ 0;
-
-  for (i = 0, j = 0; i < 6; i++) /* set LRC parity bit */
-    if (lrc[i])
-      j++;
-  if (!(j % 2))
-    lrc[6] = 1;
-  else
-    lrc[6] = 0;
-
-  for (i = 0; i < 7; i++) /* check CRC */
-    if ((lrc[i] && lrc_start[i] == '0') ||
-        (!lrc[i] && lrc_start[i] == '1')) {
-      free(string); /* free string memory */
-      free(decoded_string); /* free decoded_string memory */
-      return NULL; /* failed CRC check */
-    }
-
-  free(string); /* free string memory */
-  return decoded_string;
-
+	msr_peaks_t * pk = &au->msr_au_peaks;
+	char * p;
+	long n;
+
+	if (2 * pk->msr_pk_count > au->msr_au_nchars) {
+		p = realloc (au->msr_au_chars, 2 * pk->msr_pk_count);
+		if (p == NULL)
+			return (-1);
+		au->msr_au_chars = p;
+		au->msr_au_nchars = 2 * pk->msr_pk_count;
+		au->msr_au_allocs++;
+	}
+
+	n = msr_viterbi_decode (&au->msr_au_vt, pk->msr_pk_iv,
+	    pk->msr_pk_count, au->msr_au_bpc, au->msr_au_chars);
+	if (n == -1)
+		return (-1);
+
+	return (append (au, au->msr_au_chars, (int)n));
 }
-/********** end parsing functions **********/
-
-
-
-
-/********** dsp functions **********/
 
-/* sets the device parameters
-   [fd]            file descriptor to set ioctls on
-   [verbose]       prints verbose messages if true
-   returns         sample rate */
-int msr_dsp_init(int fd)
+/*
+ * Push samples
+ *
+ * This function decodes as many of the <count> samples in <samples>
+ * as belong to the current swipe, and returns how many it took. It
+ * takes fewer than <count> only when the swipe has ended; the bits
+ * are then ready, and no more samples are taken until msr_audio_next()
+ * is called. The rest belong to the next swipe.
+ *
+ * This function will fail if memory can't be allocated for the bits.
+ */
+
+int
+msr_audio_push (msr_audio_t * au, const int16_t * samples, int count)
 {
-  int ch, fmt, sr;
-
-  /* set audio format */
-  fmt = AFMT_S16_LE;
-  if (ioctl(fd, SNDCTL_DSP_SETFMT, &fmt) == -1) {
-    perror("SNDCTL_DSP_SETFMT");
-    exit(EXIT_FAILURE);
-  }
-  if (fmt != AFMT_S16_LE) {
-    fprintf(stderr, "*** Error: Device does not support AFMT_S16_LE\n");
-    exit(EXIT_FAILURE);
-  }
-
-  /* set audio channels */
-  ch = 0;
-  if (ioctl(fd, SNDCTL_DSP_STEREO, &ch) == -1) {
-    perror("SNDCTL_DSP_STEREO");
-    exit(EXIT_FAILURE);
-  }
-  if (ch != 0) {
-    fprintf(stderr, "*** Error: Device does not support monaural recording\n");
-    exit(EXIT_FAILURE);
-  }
-
-  /* set sample rate */
-  sr = SAMPLE_RATE;
-  if (ioctl(fd, SNDCTL_DSP_SPEED, &sr) == -1) {
-    perror("SNDCTL_DSP_SPEED");
-    exit(EXIT_FAILURE);
-  }
-  if (sr != SAMPLE_RATE)
-    fprintf(stderr, "*** Warning: Highest supported sample rate is %d\n", sr);
-
-  return sr;
+	msr_segment_t * sg = &au->msr_au_seg;
+	long pos = sg->msr_sg_pos;
+	int i = 0, end;
+
+	if (au->msr_au_ready)
+		return (0);
+
+	/* Skip the silence before the swipe, and find the silence after. */
+	end = msr_segment_push (sg, samples, count);
+	if (!au->msr_au_inswipe) {
+		if (!sg->msr_sg_inswipe && !sg->msr_sg_ready)
+			return (end);
+		i = sg->msr_sg_start - pos;
+		au->msr_au_inswipe = 1;
+	}
+
+	if (decode (au, samples + i, end - i) == -1)
+		return (-1);
+	if (sg->msr_sg_ready && msr_audio_finish (au) == -1)
+		return (-1);
+
+	return (end);
 }
 
+/*
+ * End the swipe in progress, if there is one, as at the end of the
+ * input. Returns 1 if there are bits ready, 0 if not, or -1 if memory
+ * can't be allocated for them.
+ */
 
-/* prints the maximum dsp level to aid in setting the silence threshold
-   [fd]            file descriptor to read from
-   [sample_rate]   sample rate of device */
-void msr_print_max_level(int fd, int sample_rate)
+int
+msr_audio_finish (msr_audio_t * au)
 {
-  int i;
-  short int buf, last = 0;
-
-  printf("Terminating after %d seconds...\n", MAX_TERM);
-
-  for (i = 0; i < sample_rate * MAX_TERM; i++) {
-
-    /* read from fd */
-    msr_read(fd, &buf, sizeof (short int));
-
-    /* take absolute value */
-    if (buf < 0)
-      buf = -buf;
-
-    /* print if highest level */
-    if (buf > last) {
-      printf("Maximum level: %d\r", buf);
-      fflush(stdout);
-      last = buf;
-    }
-  }
-
-  printf("\n");
+	char bits[1];
+	int n;
+
+	if (au->msr_au_inswipe) {
+		n = msr_biphase_flush (&au->msr_au_bp, bits);
+		if (au->msr_au_ml ? viterbi (au) == -1 :
+		    append (au, bits, n) == -1)
+			return (-1);
+		au->msr_au_inswipe = 0;
+		au->msr_au_ready = 1;
+	}
+
+	return (au->msr_au_ready);
 }
 
+/*
+ * Get the bits of a swipe that has ended. This function stores a
+ * pointer to them in <bits>, valid until msr_audio_next(), and
+ * returns how many there are, or returns -1 if the swipe isn't over.
+ * A swipe of noise may have no bits at all.
+ */
 
-/* finds the maximum value in sample
-   ** global **
-   [sample]        sample
-   [sample_size]   number of frames in sample */
-short int msr_evaluate_max(void)
+long
+msr_audio_bits (msr_audio_t * au, const uint8_t ** bits)
 {
-  int i;
-  short int max = 0;
+	if (!au->msr_au_ready)
+		return (-1);
 
-  for (i = 0; i < audio_sample_size; i++) {
-    if (audio_sample[i] > max)
-       max = audio_sample[i];
-  }
+	*bits = au->msr_au_bits;
 
-  return max;
+	return (au->msr_au_nbits);
 }
 
-
-/* pauses until the dsp level is above the silence threshold
-   [fd]            file descriptor to read from
-   [silence_thres] silence threshold */
-void msr_silence_pause(int fd, int silence_thres)
+/* Get ready for the next swipe, keeping the decoder's settings. */
+void
+msr_audio_next (msr_audio_t * au)
 {
-  short int buf = 0;
-
-  /* loop while silent */
-  while (buf < silence_thres) {
-
-    /* read from fd */
-    msr_read(fd, &buf, sizeof (short int));
-
-    /* absolute value */
-    if (buf < 0)
-      buf = -buf;
-  }
+	if (au->msr_au_bits != NULL)
+		memset (au->msr_au_bits, 0, au->msr_au_size);
+	au->msr_au_nbits = 0;
+	au->msr_au_ready = 0;
+	au->msr_au_inswipe = 0;
+	msr_segment_reset (&au->msr_au_seg);
+	au->msr_au_peaks.msr_pk_count = 0;
+	msr_biphase_reset (&au->msr_au_bp);
 }
 
+/* Read bit <i> of <nbits>, from the far end if <reverse>. */
+#define BIT(bits, nbits, i, reverse)					\
+	(((bits)[((reverse) ? (nbits) - 1 - (i) : (i)) / 8] >>		\
+	  (7 - ((reverse) ? (nbits) - 1 - (i) : (i)) % 8)) & 1)
 
-/* gets a sample, terminating when the input goes below the silence threshold
-   [fd]            file descriptor to read from
-   [sample_rate]   sample rate of device
-   [silence_thres] silence threshold
-   ** global **
-   [sample]        sample
-   [sample_size]   number of frames in sample */
-void msr_get_dsp(int fd, int sample_rate, int silence_thres)
-{
-  int count = 0, eos = 0, i;
-  short buf;
-
-  audio_sample_size = 0;
-
-  /* wait for sample */
-  msr_silence_pause(fd, silence_thres);
-
-  while (!eos) {
-    /* fill buffer */
-    audio_sample = msr_realloc(audio_sample, sizeof (short int) * (BUF_SIZE * (count + 1)));
-    for (i = 0; i < BUF_SIZE; i++) {
-      msr_read(fd, &buf, sizeof (short int));
-      audio_sample[i + (count * BUF_SIZE)] = buf;
-    }
-    count++;
-    audio_sample_size = count * BUF_SIZE;
-
-    /* check for silence */
-    eos = 1;
-    if (audio_sample_size > (sample_rate * END_LENGTH) / 1000) {
-      for (i = 0; i < (sample_rate * END_LENGTH) / 1000; i++)  {
-        buf = audio_sample[(count * BUF_SIZE) - i - 1];
-        if (buf < 0)
-          buf = -buf;
-        if (buf > silence_thres)
-          eos = 0;
-      }
-    } else
-      eos = 0;
-  }
-}
-/********** end dsp functions **********/
-
+/*
+ * Read the character of <bpc> bits, least significant first and
+ * parity bit included, that starts at bit <at>.
+ */
 
-/********** begin sndfile functions **********/
-/* open the file
-   [fd]          file to open
-   [verbose]     verbosity flag
-   ** global **
-   [sample_size] number of frames in the file */
-SNDFILE *msr_sndfile_init(int fd)
+static int
+character (const uint8_t * bits, long nbits, int reverse, long at, int bpc)
 {
-  SNDFILE *sndfile;
-  SF_INFO sfinfo;
-
-  /* clear sfinfo structure */
-  memset(&sfinfo, 0, sizeof(sfinfo));
-
-  /* set sndfile from file descriptor */
-  sndfile = sf_open_fd(fd, SFM_READ, &sfinfo, 0);
-  if (sndfile == NULL) {
-    fprintf(stderr, "*** Error: sf_open_fd() failed\n");
-    exit(EXIT_FAILURE);
-  }
-
-  /* this was if(verbose) but might be useful...*/
-  /* print some statistics
-    fprintf(stderr, "*** Input file format:\n"
-            "    Frames: %i\n"
-            "    Sample Rate: %i\n"
-            "    Channels: %i\n"
-            "    Format: 0x%08x\n"
-            "    Sections: %i\n"
-            "    Seekable: %i\n",
-            (int)sfinfo.frames, sfinfo.samplerate, sfinfo.channels,
-            sfinfo.format, sfinfo.sections, sfinfo.seekable);
-  }
-  */
-  /* ensure that the file is monaural */
-  if (sfinfo.channels != 1) {
-    fprintf(stderr, "*** Error: Only monaural files are supported\n");
-    exit(EXIT_FAILURE);
-  }
-
-  /* set sample size */
-  audio_sample_size = sfinfo.frames;
-
-  return sndfile;
-}
+	int c = 0, i;
 
+	for (i = 0; i < bpc; i++)
+		c |= BIT (bits, nbits, at + i, reverse) << i;
 
-/* read in data from libsndfile
-   [sndfile]     SNDFILE pointer from sf_open() or sf_open_fd()
-   ** global **
-   [sample]      sample
-   [sample_size] number of frames in sample */
-void msr_get_sndfile(SNDFILE *sndfile)
-{
-  sf_count_t count;
-
-  /* allocate memory for sample */
-  audio_sample = msr_malloc(sizeof(short int) * audio_sample_size);
-
-  /* read in sample */
-  count = sf_read_short(sndfile, audio_sample, audio_sample_size);
-  if (count != audio_sample_size) {
-    fprintf(stderr, "*** Warning: expected %i frames, read %i.\n",
-            audio_sample_size, (int)count);
-    audio_sample_size = count;
-  }
+	return (c);
 }
 
-/********** end sndfile functions **********/
-
-
-/* decodes aiken biphase and prints binary
-   [freq_thres]    frequency threshold
-   ** global **
-   [sample]        sample
-   [sample_size]   number of frames in sample */
-void msr_decode_aiken_biphase(int freq_thres, int silence_thres)
+/*
+ * Parse the bits of a swipe
+ *
+ * This function looks through the <nbits> bits in <bits>, read
+ * backwards if <reverse>, for a track of <bpc> bit characters: 5 for
+ * ABA (track 2 and 3) or 7 for IATA (track 1). It stores the
+ * characters from the start sentinel to the end sentinel in <out>,
+ * which holds <outlen> bytes, as a string, and returns its length.
+ *
+ * This function will fail if there is no start sentinel, if any
+ * character fails its parity check, if the longitudinal redundancy
+ * check fails, or if the characters don't fit in <out>.
+ */
+
+int
+msr_audio_parse (const uint8_t * bits, long nbits, int bpc, int reverse,
+    char * out, size_t outlen)
 {
-  int i = 0, peak = 0, ppeak = 0;
-  int *peaks = NULL, peaks_size = 0;
-  int zerobl;
-
-  /* absolute value */
-  for (i = 0; i < audio_sample_size; i++)
-    if (audio_sample[i] < 0)
-      audio_sample[i] = -audio_sample[i];
-
-  /* store peak differences */
-  i = 0;
-  while (i < audio_sample_size) {
-    /* old peak value */
-    ppeak = peak;
-    /* find peaks */
-    while (i < audio_sample_size && audio_sample[i] <= silence_thres)
-      i++;
-    peak = 0;
-    while (i < audio_sample_size && audio_sample[i] > silence_thres) {
-      if (audio_sample[i] > audio_sample[peak])
-        peak = i;
-      i++;
-    }
-    if (peak - ppeak > 0) {
-      peaks = msr_realloc(peaks, sizeof(int) * (peaks_size + 1));
-      peaks[peaks_size] = peak - ppeak;
-      peaks_size++;
-    }
-  }
-
-  /* decode aiken biphase allowing for
-     frequency deviation based on freq_thres */
-  /* ignore first two peaks and last peak */
-  if (peaks_size < 2) {
-    fprintf(stderr, "*** Error: No data detected\n");
-    exit(EXIT_FAILURE);
-  }
-  zerobl = peaks[2];
-  for (i = 2; i < peaks_size - 1; i++) {
-    if (peaks[i] < ((zerobl / 2) + (freq_thres * (zerobl / 2) / 100)) &&
-        peaks[i] > ((zerobl / 2) - (freq_thres * (zerobl / 2) / 100))) {
-      if (peaks[i + 1] < ((zerobl / 2) + (freq_thres * (zerobl / 2) / 100)) &&
-          peaks[i + 1] > ((zerobl / 2) - (freq_thres * (zerobl / 2) / 100))) {
-        printf("1");
-        zerobl = peaks[i] * 2;
-        i++;
-      }
-    } else if (peaks[i] < (zerobl + (freq_thres * zerobl / 100)) &&
-               peaks[i] > (zerobl - (freq_thres * zerobl / 100))) {
-      printf("0");
-#ifndef DISABLE_VC
-      zerobl = peaks[i];
-#endif
-    }
-  }
-  printf("\n");
-
+	uint8_t chars[MSR_MAX_TRACK_LEN + 1];
+	msr_charcheck_t cc;
+	long at;
+	int base, ss_c, nchars, flags, i;
+
+	if (bpc == MSR_ABA_BPC) {
+		base = '0';
+		ss_c = msr_addparity (MSR_ABA_SS, bpc);
+	} else if (bpc == MSR_IATA_BPC) {
+		base = ' ';
+		ss_c = msr_addparity (MSR_IATA_SS, bpc);
+	} else
+		return (-1);
+
+	/* The start sentinel can be anywhere after the clocking bits. */
+	for (at = 0; at + bpc <= nbits; at++)
+		if (character (bits, nbits, reverse, at, bpc) == ss_c)
+			break;
+
+	/* Frame the rest from there; a track is no longer than this. */
+	for (nchars = 0; nchars < (int)sizeof (chars) &&
+	    at + bpc <= nbits; nchars++, at += bpc)
+		chars[nchars] = character (bits, nbits, reverse, at, bpc);
+	if (nchars == 0)
+		return (-1);
+
+	/* Whatever follows the LRC is noise on the way out. */
+	msr_check_chars (chars, nchars, bpc, &cc);
+	if (cc.msr_cc_es == -1)
+		return (-1);
+	nchars = cc.msr_cc_es + 2;
+	flags = msr_check_chars (chars, nchars, bpc, &cc);
+	if ((flags & MSR_VALID_PARITY) == 0 || (flags & MSR_VALID_LRC) == 0 ||
+	    (size_t)nchars > outlen)
+		return (-1);
+
+	/* Characters up to and including the end sentinel. */
+	for (i = 0; i < nchars - 1; i++)
+		out[i] = (chars[i] & ((1 << (bpc - 1)) - 1)) + base;
+	out[i] = '\0';
+
+	return (i);
 }
@@ -1,20 +1,57 @@
-/*from dab.c   */
+#ifndef _AUDIO_H_
+#define _AUDIO_H_
 
-#define DEVICE        "/dev/dsp" /* default sound card device */
-#define SAMPLE_RATE   192000     /* default sample rate (hz) */
-#define SILENCE_THRES 5000       /* initial silence threshold */
+#include "biphase.h"
+#include "segment.h"
+#include "viterbi.h"
 
-/* #define DISABLE_VC */
+/*
+ * Swipe decoding from audio.
+ *
+ * A context follows one head: samples are pushed in as they come,
+ * the silence before a swipe is skipped, the swipe is decoded as it
+ * goes by, and it ends at MSR_AUDIO_END_MS of silence. Its bits are
+ * then handed back packed, eight to a byte, most significant bit
+ * first (as msr_getbit() reads them). Contexts share nothing, so any
+ * number of them can run at once, one per head or per thread.
+ *
+ * The bits can also be decided on by maximum likelihood, over the
+ * whole swipe once it has ended, rather than as it goes by; this
+ * costs more, but rides out noise much better.
+ */
 
-#define AUTO_THRES    30    /* pct of highest value to set silence_thres to */
-#define BUF_SIZE      1024  /* buffer size */
-#define END_LENGTH    200   /* msec of silence to determine end of sample */
-#define FREQ_THRES    60    /* frequency threshold (pct) */
-#define MAX_TERM      60    /* sec before termination of msr_print_max_level() */
+/* Defaults. */
+#define MSR_AUDIO_RATE		192000	/* Sample rate (hz) */
+#define MSR_AUDIO_THRES		5000	/* Silence threshold */
+#define MSR_AUDIO_FREQ_THRES	60	/* Allowed period deviation (pct) */
+#define MSR_AUDIO_END_MS	200	/* Silence that ends a swipe */
 
+typedef struct msr_audio {
+	msr_biphase_t	msr_au_bp;	/* Bit decoder; set it up as wanted */
+	msr_segment_t	msr_au_seg;	/* Where the swipe starts and ends */
+	int		msr_au_inswipe;	/* Decoding a swipe */
+	int		msr_au_ready;	/* Swipe over; bits ready */
+	uint8_t *	msr_au_bits;	/* Packed bits of the swipe */
+	long		msr_au_nbits;
+	long		msr_au_size;	/* Room in msr_au_bits, in bytes */
+	long		msr_au_allocs;	/* Times it has had to grow */
 
+	/* Maximum likelihood decoding, if wanted. */
+	int		msr_au_ml;
+	int		msr_au_bpc;	/* Character size, 0 if unknown */
+	msr_peaks_t	msr_au_peaks;	/* Intervals of the swipe */
+	msr_viterbi_t	msr_au_vt;
+	char *		msr_au_chars;	/* Bits decided on, as characters */
+	long		msr_au_nchars;	/* Room in msr_au_chars */
+} msr_audio_t;
 
-/* from dmsb.c   */
+extern int msr_audio_init (msr_audio_t *, int, int, int);
+extern void msr_audio_free (msr_audio_t *);
+extern void msr_audio_viterbi (msr_audio_t *, int, int);
+extern int msr_audio_push (msr_audio_t *, const int16_t *, int);
+extern int msr_audio_finish (msr_audio_t *);
+extern long msr_audio_bits (msr_audio_t *, const uint8_t **);
+extern void msr_audio_next (msr_audio_t *);
+extern int msr_audio_parse (const uint8_t *, long, int, int, char *, size_t);
 
-extern short int *audio_sample = NULL;
-extern int audio_sample_size = 0;
+#endif /* _AUDIO_H_ */
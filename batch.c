@@ -0,0 +1,125 @@
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmsr.h"
+#include "parallel.h"
+
+/*
+ * Batch decoding.
+ *
+ * Re-decoding an archive of raw reads one msr_tracks_t at a time
+ * spends most of its time shuffling 771 byte structures around. The
+ * batch interface takes the tracks as flat arrays instead and splits
+ * them over a pool of threads, each of which decodes, validates and
+ * (optionally) reverses its share straight into the caller's output
+ * arrays.
+ */
+
+typedef struct msr_batch_job {
+	const msr_batch_t *	msr_bj_in;
+	msr_batch_out_t *	msr_bj_out;
+	int			msr_bj_bpc;
+	int			msr_bj_flags;
+} msr_batch_job_t;
+
+static void
+decode_one (void * arg, int n)
+{
+	msr_batch_job_t * j = arg;
+	const msr_batch_t * in = j->msr_bj_in;
+	msr_batch_out_t * out = j->msr_bj_out;
+	uint8_t rev[MSR_MAX_TRACK_LEN];
+	uint8_t * raw, * dec;
+	uint8_t len, outlen;
+	int i, status;
+
+	raw = in->msr_bt_data + (size_t)n * in->msr_bt_stride;
+	len = in->msr_bt_lens[n];
+	if (len > in->msr_bt_stride)
+		len = in->msr_bt_stride;
+
+	/* Reverse into a scratch copy; the input is left alone. */
+	if (j->msr_bj_flags & MSR_BATCH_REVERSE) {
+		for (i = 0; i < len; i++)
+			rev[i] = msr_reverse_byte (raw[len - 1 - i]);
+		raw = rev;
+	}
+
+	dec = out->msr_bo_data + (size_t)n * out->msr_bo_stride;
+	outlen = out->msr_bo_stride > MSR_MAX_TRACK_LEN ?
+	    MSR_MAX_TRACK_LEN : out->msr_bo_stride;
+
+	status = msr_validate (raw, len, j->msr_bj_bpc);
+	if (msr_decode (raw, len, dec, &outlen, j->msr_bj_bpc) == 0)
+		status |= MSR_BATCH_DECODED;
+	else
+		outlen = 0;
+
+	out->msr_bo_lens[n] = outlen;
+	if (out->msr_bo_status != NULL)
+		out->msr_bo_status[n] = status;
+}
+
+/*
+ * Decode a batch of raw tracks
+ *
+ * This function decodes each of the tracks in <in> as characters of
+ * <bpc> bits, using up to <nthreads> threads (zero means one per
+ * CPU), and stores the decoded characters, their lengths and a
+ * status word for every track in <out>. All of the output arrays
+ * must be allocated by the caller and have room for
+ * <in>->msr_bt_count entries. If <flags> contains MSR_BATCH_REVERSE
+ * each track is reversed first, as with msr_reverse_track(). A track
+ * whose decoded characters don't fit in the output stride gets a
+ * decoded length of zero and no MSR_BATCH_DECODED status.
+ *
+ * If <stats> is not NULL it receives the run time and throughput.
+ *
+ * This function will fail if the batch description is invalid.
+ */
+
+int
+msr_batch_decode (const msr_batch_t * in, int bpc, int flags,
+    msr_batch_out_t * out, int nthreads, msr_batch_stats_t * stats)
+{
+	msr_batch_job_t j;
+	struct timeval start, end;
+	int threads;
+
+	if (in == NULL || out == NULL || in->msr_bt_count < 0 ||
+	    in->msr_bt_stride < 1 || out->msr_bo_stride < 1 ||
+	    in->msr_bt_lens == NULL || in->msr_bt_data == NULL ||
+	    out->msr_bo_lens == NULL || out->msr_bo_data == NULL)
+		return (-1);
+	if (bpc < 1 || bpc > 8)
+		return (-1);
+
+	j.msr_bj_in = in;
+	j.msr_bj_out = out;
+	j.msr_bj_bpc = bpc;
+	j.msr_bj_flags = flags;
+
+	gettimeofday (&start, NULL);
+	threads = msr_parallel_for (in->msr_bt_count, nthreads, decode_one, &j);
+	gettimeofday (&end, NULL);
+
+	if (threads == -1)
+		return (-1);
+
+	if (stats != NULL) {
+		stats->msr_bs_tracks = in->msr_bt_count;
+		stats->msr_bs_threads = threads;
+		stats->msr_bs_seconds = (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1000000.0;
+		stats->msr_bs_tracks_per_sec = stats->msr_bs_seconds > 0 ?
+		    in->msr_bt_count / stats->msr_bs_seconds : 0;
+	}
+
+	return (0);
+}
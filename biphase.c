@@ -0,0 +1,689 @@
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "biphase.h"
+#include "pcm.h"
+
+/*
+ * Streaming Aiken biphase decoder.
+ *
+ * This is the decoder from dab, turned inside out. Rather than
+ * rectifying a whole recording, collecting every peak and then
+ * walking the peak list, we scan each chunk as it arrives (with the
+ * kernels in pcm.c), close off a peak whenever the level drops back
+ * under the threshold, and feed the distance from the previous peak
+ * straight into the bit decoder. The bit decoder needs to see one
+ * interval past the current one (a one bit is two half length
+ * intervals in a row), so bits trail the signal by at most two flux
+ * transitions.
+ *
+ * The results are the same as the batch decoder's: the first two
+ * intervals are taken to be noise from the head landing on the
+ * stripe, the third sets the initial bit length, and the last one
+ * is dropped.
+ *
+ * A threshold picked after the fact from the loudest sample of the
+ * whole swipe needs the whole swipe first, and is wrong for swipes
+ * that get louder or quieter along the way. With an adaptive
+ * threshold the chunks are cut into blocks, and before each block
+ * is scanned the threshold is set from the loudest sample in the
+ * last few blocks, this one included. The window is short enough to
+ * follow a card speeding up or lifting off the head, and long enough
+ * to always hold several flux transitions.
+ *
+ * The bit decoder's idea of the bit length is normally the length of
+ * the last bit: one noisy transition and the next bit is judged
+ * against a bad length, which is how bits get lost at the ends of a
+ * hand swipe. With clock recovery on, a second order phase locked
+ * loop keeps the bit clock instead. Each transition lands either
+ * near the middle of the current bit cell (half of a one) or near
+ * its end, and how far it is from where it should be nudges both the
+ * phase and the period of the clock, by gains set from the loop
+ * bandwidth.
+ * A narrow loop rides out jitter; a wide one follows fast changes
+ * in swipe speed. The clock starts from the length of a single bit,
+ * which can be well off, so the loop runs wide open for the first
+ * few bits to lock on, then narrows to the bandwidth asked for.
+ *
+ * A peak found by its loudest sample is only as precise as the sample
+ * rate: at 48 kHz, a bit on a slow card is ten samples long, and one
+ * sample either way is a tenth of a bit. The head's output peaks where
+ * the flux changes, and near the top it is close to a parabola, so
+ * with interpolation on, the parabola through the loudest sample and
+ * its two neighbours says where between them the real peak was.
+ * Intervals come out in 1/MSR_BIPHASE_SUB samples, and the rest of
+ * the decoder works in those units.
+ */
+
+/* Loop damping factor (1/sqrt(2)): critically damped. */
+#define MSR_BIPHASE_ZETA	0.70710678
+
+/* Loop bandwidth (pct) and length, in bits, of the locking on phase. */
+#define MSR_BIPHASE_ACQ_BW	25
+#define MSR_BIPHASE_ACQ_BITS	16
+
+/* Is <x> within <pct> percent of <len>? The rounding is dab's. */
+#define NEAR(x, len, pct)						\
+	((x) < (len) + (pct) * (len) / 100 &&				\
+	 (x) > (len) - (pct) * (len) / 100)
+
+void
+msr_biphase_init (msr_biphase_t * bp, int thres, int freq_thres)
+{
+	bp->msr_bp_thres = thres;
+	bp->msr_bp_freq_thres = freq_thres;
+	bp->msr_bp_adapt = 0;
+	bp->msr_bp_pll = 0;
+	bp->msr_bp_follow = 1;
+	bp->msr_bp_scale = 1;
+	bp->msr_bp_times = NULL;
+	bp->msr_bp_keep = NULL;
+	msr_biphase_reset (bp);
+}
+
+/*
+ * Place peaks between samples if <on>, or at the loudest sample if
+ * not. Intervals handed to msr_biphase_intervals() must be in the same
+ * units, which msr_peaks_find() does with msr_pk_interp set.
+ */
+
+void
+msr_biphase_interp (msr_biphase_t * bp, int on)
+{
+	bp->msr_bp_scale = on ? MSR_BIPHASE_SUB : 1;
+	msr_biphase_reset (bp);
+}
+
+/*
+ * Follow the signal level, setting the threshold to <pct> percent of
+ * the envelope, or go back to the fixed threshold if <pct> is zero.
+ * The fixed threshold stays as the floor, so silence stays silent.
+ */
+
+void
+msr_biphase_adapt (msr_biphase_t * bp, int pct)
+{
+	bp->msr_bp_adapt = pct;
+	msr_biphase_reset (bp);
+}
+
+/*
+ * Follow changes in swipe speed if <on>, taking the length of each
+ * zero bit as that of the next, or only learn it from ones if not.
+ * On by default.
+ */
+
+void
+msr_biphase_follow (msr_biphase_t * bp, int on)
+{
+	bp->msr_bp_follow = on;
+	msr_biphase_reset (bp);
+}
+
+/*
+ * Recover the bit clock with a phase locked loop of <bw> percent of the
+ * bit rate bandwidth, or go back to following the last bit if <bw> is
+ * zero.
+ */
+
+static void
+gains (int bw, double * kp, double * ki)
+{
+	double theta, d;
+
+	theta = bw / 100.0 /
+	    (MSR_BIPHASE_ZETA + 1 / (4 * MSR_BIPHASE_ZETA));
+	d = 1 + 2 * MSR_BIPHASE_ZETA * theta + theta * theta;
+
+	*kp = 4 * MSR_BIPHASE_ZETA * theta / d;
+	*ki = 4 * theta * theta / d;
+}
+
+void
+msr_biphase_pll (msr_biphase_t * bp, int bw)
+{
+	bp->msr_bp_pll = bw;
+	gains (bw, &bp->msr_bp_kp, &bp->msr_bp_ki);
+	gains (bw > MSR_BIPHASE_ACQ_BW ? bw : MSR_BIPHASE_ACQ_BW,
+	    &bp->msr_bp_acq_kp, &bp->msr_bp_acq_ki);
+	msr_biphase_reset (bp);
+}
+
+/*
+ * Record when each bit went by in <times>, or stop if it is NULL. Like
+ * the bits, <times> must have room for as many entries as there are
+ * samples or intervals passed in, and entry i describes bits[i] of the
+ * latest call.
+ */
+
+void
+msr_biphase_times (msr_biphase_t * bp, msr_bittime_t * times)
+{
+	bp->msr_bp_times = times;
+}
+
+/*
+ * Keep the interval between each pair of peaks in <pk> as well, or
+ * stop if it is NULL, for decoders that want the whole swipe. Room
+ * must be made with msr_peaks_reserve() before each push (half as many
+ * intervals as samples, and one more for the flush); intervals that
+ * don't fit are dropped.
+ */
+
+void
+msr_biphase_keep (msr_biphase_t * bp, msr_peaks_t * pk)
+{
+	bp->msr_bp_keep = pk;
+}
+
+/* Get ready for a new swipe, keeping the thresholds. */
+void
+msr_biphase_reset (msr_biphase_t * bp)
+{
+	bp->msr_bp_pos = 0;
+	bp->msr_bp_inrun = 0;
+	bp->msr_bp_runmax = 0;
+	bp->msr_bp_runpeak = 0;
+	bp->msr_bp_ppeak = 0;
+	bp->msr_bp_prev = 0;
+	bp->msr_bp_left = 0;
+	bp->msr_bp_right = 0;
+	bp->msr_bp_rightdue = 0;
+	bp->msr_bp_nint = 0;
+	bp->msr_bp_zerobl = 0;
+	bp->msr_bp_held = 0;
+	bp->msr_bp_nbits = 0;
+	bp->msr_bp_clock = 0;
+
+	bp->msr_bp_period = 0;
+	bp->msr_bp_phase = 0;
+	bp->msr_bp_half = 0;
+
+	bp->msr_bp_level = bp->msr_bp_thres;
+	memset (bp->msr_bp_env, 0, sizeof(bp->msr_bp_env));
+	bp->msr_bp_envpos = 0;
+	bp->msr_bp_lo = 0;
+	bp->msr_bp_hi = 0;
+}
+
+/* Store a bit, and when it ended if anyone is asking. */
+static int
+emit (msr_biphase_t * bp, char * bits, char c, long at, double period)
+{
+	msr_bittime_t * t;
+
+	bits[0] = c;
+	if (bp->msr_bp_times != NULL) {
+		t = &bp->msr_bp_times[bits - bp->msr_bp_bits];
+		t->msr_bt_at = (at + bp->msr_bp_scale / 2) / bp->msr_bp_scale;
+		t->msr_bt_period = period / bp->msr_bp_scale;
+	}
+
+	return (1);
+}
+
+/*
+ * Decode the interval held over from last time, now that we know the
+ * one that follows it. Returns the number of bits stored in <bits>.
+ */
+
+static int
+decode (msr_biphase_t * bp, int next, char * bits)
+{
+	int x = bp->msr_bp_held;
+	int zerobl = bp->msr_bp_zerobl;
+	int pct = bp->msr_bp_freq_thres;
+
+	bp->msr_bp_held = next;
+
+	if (NEAR (x, zerobl / 2, pct)) {
+		if (NEAR (next, zerobl / 2, pct)) {
+			/* Two half bits in a row: a one. */
+			bp->msr_bp_zerobl = x * 2;
+			bp->msr_bp_held = 0;
+			return (emit (bp, bits, '1', bp->msr_bp_clock, x * 2));
+		}
+	} else if (NEAR (x, zerobl, pct)) {
+		/* Follow changes in swipe speed. */
+		if (bp->msr_bp_follow)
+			bp->msr_bp_zerobl = x;
+		return (emit (bp, bits, '0', bp->msr_bp_clock - next, x));
+	}
+
+	return (0);
+}
+
+/*
+ * Place a transition <x> samples after the last one against the
+ * recovered clock. Returns the number of bits stored in <bits>.
+ */
+
+static int
+pll (msr_biphase_t * bp, int x, char * bits)
+{
+	double t, e, kp, ki, period = bp->msr_bp_period;
+	char c;
+
+	if (bp->msr_bp_nbits < MSR_BIPHASE_ACQ_BITS) {
+		kp = bp->msr_bp_acq_kp;
+		ki = bp->msr_bp_acq_ki;
+	} else {
+		kp = bp->msr_bp_kp;
+		ki = bp->msr_bp_ki;
+	}
+
+	t = bp->msr_bp_phase + x;
+	if (t < period * 3 / 4) {
+		/* The middle of a one, or a glitch inside the cell. */
+		if (!bp->msr_bp_half) {
+			e = t - period / 2;
+			bp->msr_bp_period += ki * e;
+			t -= kp * e;
+		}
+		bp->msr_bp_half = 1;
+		bp->msr_bp_phase = t;
+		return (0);
+	}
+
+	/* The end of the cell; move the clock part way towards it. */
+	e = t - period;
+	if (t < period * 3 / 2) {
+		bp->msr_bp_period += ki * e;
+		bp->msr_bp_phase = (1 - kp) * e;
+	} else {
+		/* Lost a transition; don't learn from it. */
+		bp->msr_bp_phase = 0;
+	}
+
+	c = bp->msr_bp_half ? '1' : '0';
+	bp->msr_bp_half = 0;
+
+	return (emit (bp, bits, c, bp->msr_bp_clock, bp->msr_bp_period));
+}
+
+/* Hand the interval between two peaks to the bit decoder. */
+static int
+interval (msr_biphase_t * bp, int x, char * bits)
+{
+	int n = 0;
+
+	if (bp->msr_bp_nint >= 1)
+		bp->msr_bp_clock += x;
+
+	if (bp->msr_bp_pll && bp->msr_bp_nint >= 2) {
+		if (bp->msr_bp_nint == 2) {
+			/* The first clocking bit sets the clock going. */
+			bp->msr_bp_period = x;
+			bp->msr_bp_phase = 0;
+		}
+		n = pll (bp, x, bits);
+	} else if (bp->msr_bp_nint >= 2) {
+		if (bp->msr_bp_nint == 2)
+			bp->msr_bp_zerobl = x;
+		if (bp->msr_bp_held != 0)
+			n = decode (bp, x, bits);
+		else
+			bp->msr_bp_held = x;
+	}
+
+	bp->msr_bp_nint++;
+	bp->msr_bp_nbits += n;
+
+	return (n);
+}
+
+/*
+ * Where, in 1/MSR_BIPHASE_SUB samples, is the top of the parabola
+ * through samples <a>, <b> and <c>, of which <b> at <k> is the loudest?
+ */
+
+static long
+place (long k, int a, int b, int c)
+{
+	long d;
+
+	a = abs (a);
+	b = abs (b);
+	c = abs (c);
+
+	/* A flat top; leave it where it is. */
+	d = a - 2L * b + c;
+	if (d >= 0)
+		return (k * MSR_BIPHASE_SUB);
+
+	return (k * MSR_BIPHASE_SUB + (MSR_BIPHASE_SUB / 2) * (long)(a - c) / d);
+}
+
+/* A run above the threshold has ended; pass its peak on. */
+static int
+peak (msr_biphase_t * bp, char * bits)
+{
+	long x, at;
+
+	at = bp->msr_bp_runpeak;
+	if (bp->msr_bp_scale != 1) {
+		/* Cut off by the end of the input: no right hand side. */
+		if (bp->msr_bp_rightdue)
+			bp->msr_bp_right = bp->msr_bp_left;
+		bp->msr_bp_rightdue = 0;
+		at = place (at, bp->msr_bp_left, bp->msr_bp_runmax,
+		    bp->msr_bp_right);
+	}
+
+	x = at - bp->msr_bp_ppeak;
+	bp->msr_bp_ppeak = at;
+	bp->msr_bp_inrun = 0;
+
+	if (x <= 0)
+		return (0);
+	if (bp->msr_bp_keep != NULL &&
+	    bp->msr_bp_keep->msr_pk_count < bp->msr_bp_keep->msr_pk_size)
+		bp->msr_bp_keep->msr_pk_iv[bp->msr_bp_keep->msr_pk_count++] =
+		    (int)x;
+	return (interval (bp, (int)x, bits));
+}
+
+/* Run the peak finder over <count> samples at the current threshold. */
+static int
+scan (msr_biphase_t * bp, const int16_t * samples, long count, char * bits)
+{
+	long i = 0, j, k;
+	int top, n = 0;
+
+	if (count <= 0)
+		return (0);
+	if (bp->msr_bp_rightdue) {
+		bp->msr_bp_right = samples[0];
+		bp->msr_bp_rightdue = 0;
+	}
+
+	while (i < count) {
+		if (!bp->msr_bp_inrun) {
+			j = msr_pcm_above (samples + i, count - i,
+			    bp->msr_bp_level);
+			i += j;
+			bp->msr_bp_pos += j;
+			if (i == count)
+				break;
+			bp->msr_bp_inrun = 1;
+			bp->msr_bp_runmax = -1;
+		}
+
+		/* The run may carry on into the next chunk. */
+		j = msr_pcm_below (samples + i, count - i, bp->msr_bp_level);
+		k = msr_pcm_peak (samples + i, j, &top);
+		if (j > 0 && top > bp->msr_bp_runmax) {
+			bp->msr_bp_runmax = top;
+			bp->msr_bp_runpeak = bp->msr_bp_pos + k;
+
+			/* The neighbours may be in other chunks. */
+			k += i;
+			bp->msr_bp_left = k > 0 ? samples[k - 1] :
+			    bp->msr_bp_prev;
+			if (k + 1 < count)
+				bp->msr_bp_right = samples[k + 1];
+			else
+				bp->msr_bp_rightdue = 1;
+		}
+		i += j;
+		bp->msr_bp_pos += j;
+		if (i == count)
+			break;
+
+		n += peak (bp, bits + n);
+		i++;
+		bp->msr_bp_pos++;
+	}
+
+	bp->msr_bp_prev = samples[count - 1];
+
+	return (n);
+}
+
+/*
+ * Set the threshold for the <count> samples in <block> from the
+ * envelope. A block split across chunks is taken a piece at a time.
+ */
+
+static void
+follow (msr_biphase_t * bp, const int16_t * block, long count)
+{
+	int i, env = 0, level, top;
+	int * slot = &bp->msr_bp_env[bp->msr_bp_envpos];
+
+	top = msr_pcm_absmax (block, count);
+	if (bp->msr_bp_pos % MSR_BIPHASE_ENV_BLOCK == 0 || top > *slot)
+		*slot = top;
+	for (i = 0; i < MSR_BIPHASE_ENV_BLOCKS; i++)
+		if (bp->msr_bp_env[i] > env)
+			env = bp->msr_bp_env[i];
+
+	level = bp->msr_bp_adapt * env / 100;
+	if (level <= bp->msr_bp_thres) {
+		bp->msr_bp_level = bp->msr_bp_thres;
+		return;
+	}
+
+	bp->msr_bp_level = level;
+	if (bp->msr_bp_lo == 0 || level < bp->msr_bp_lo)
+		bp->msr_bp_lo = level;
+	if (level > bp->msr_bp_hi)
+		bp->msr_bp_hi = level;
+}
+
+/*
+ * Decode a chunk of samples
+ *
+ * This function runs the <count> signed 16 bit samples in <samples>
+ * through the decoder and stores any bits that can be decided on as
+ * '0' and '1' characters in <bits>, which must have room for <count>
+ * characters. No terminating NUL is added.
+ *
+ * This function returns the number of bits stored.
+ */
+
+int
+msr_biphase_push (msr_biphase_t * bp, const int16_t * samples, int count,
+    char * bits)
+{
+	long i, m;
+	int n = 0;
+
+	bp->msr_bp_bits = bits;
+	if (!bp->msr_bp_adapt)
+		return (scan (bp, samples, count, bits));
+
+	/* Blocks are counted from the start of the swipe. */
+	for (i = 0; i < count; i += m) {
+		m = MSR_BIPHASE_ENV_BLOCK -
+		    bp->msr_bp_pos % MSR_BIPHASE_ENV_BLOCK;
+		if (m > count - i)
+			m = count - i;
+		follow (bp, samples + i, m);
+		n += scan (bp, samples + i, m, bits + n);
+		if (bp->msr_bp_pos % MSR_BIPHASE_ENV_BLOCK == 0)
+			bp->msr_bp_envpos = (bp->msr_bp_envpos + 1) %
+			    MSR_BIPHASE_ENV_BLOCKS;
+	}
+
+	return (n);
+}
+
+/*
+ * Report the range of thresholds used since the decoder was last
+ * reset, in <lo> and <hi>. Where the envelope never rose far enough
+ * to lift the threshold off the floor, both are the fixed threshold.
+ */
+
+void
+msr_biphase_levels (msr_biphase_t * bp, int * lo, int * hi)
+{
+	if (bp->msr_bp_hi == 0) {
+		*lo = *hi = bp->msr_bp_thres;
+		return;
+	}
+
+	*lo = bp->msr_bp_lo;
+	*hi = bp->msr_bp_hi;
+}
+
+/*
+ * End the swipe. A peak cut off by the end of the input still counts,
+ * and may complete one last bit, which is stored in <bits>.
+ *
+ * This function returns the number of bits stored.
+ */
+
+int
+msr_biphase_flush (msr_biphase_t * bp, char * bits)
+{
+	bp->msr_bp_bits = bits;
+	if (!bp->msr_bp_inrun)
+		return (0);
+
+	return (peak (bp, bits));
+}
+
+/*
+ * Decode a run of peak intervals, as found by msr_peaks_find(). This
+ * is msr_biphase_push() with the peak finding already done; <bits>
+ * must have room for <count> characters.
+ *
+ * This function returns the number of bits stored.
+ */
+
+int
+msr_biphase_intervals (msr_biphase_t * bp, const int * iv, int count,
+    char * bits)
+{
+	int i, n = 0;
+
+	bp->msr_bp_bits = bits;
+	for (i = 0; i < count; i++)
+		n += interval (bp, iv[i], bits + n);
+
+	return (n);
+}
+
+void
+msr_peaks_init (msr_peaks_t * pk)
+{
+	pk->msr_pk_iv = NULL;
+	pk->msr_pk_count = 0;
+	pk->msr_pk_size = 0;
+	pk->msr_pk_interp = 0;
+}
+
+void
+msr_peaks_free (msr_peaks_t * pk)
+{
+	free (pk->msr_pk_iv);
+	pk->msr_pk_iv = NULL;
+	pk->msr_pk_count = 0;
+	pk->msr_pk_size = 0;
+}
+
+/*
+ * Make room for <count> intervals in <pk>, keeping those already
+ * there. This function will fail if memory can't be allocated.
+ */
+
+int
+msr_peaks_reserve (msr_peaks_t * pk, long count)
+{
+	int * iv;
+	long size = pk->msr_pk_size;
+
+	if (count <= size)
+		return (0);
+
+	/* Grow geometrically, so a swipe costs a few allocations at most. */
+	if (size < 1024)
+		size = 1024;
+	while (size < count)
+		size *= 2;
+
+	iv = realloc (pk->msr_pk_iv, size * sizeof(int));
+	if (iv == NULL)
+		return (-1);
+	pk->msr_pk_iv = iv;
+	pk->msr_pk_size = size;
+
+	return (0);
+}
+
+/*
+ * Find the peaks in a swipe
+ *
+ * This function finds the largest sample in every run of the <count>
+ * samples in <samples> that rises above <thres>, and stores the
+ * distance of each from the one before it in <pk>, replacing what was
+ * there. Every peak but the last needs a sample under the threshold
+ * after it, so there can't be more than half as many peaks as samples,
+ * and that is what gets allocated, once. Later swipes no longer than
+ * the longest seen so far reuse the storage. With msr_pk_interp set,
+ * peaks are placed between samples and the intervals are in
+ * 1/MSR_BIPHASE_SUB samples.
+ *
+ * This function will fail if memory can't be allocated.
+ */
+
+int
+msr_peaks_find (msr_peaks_t * pk, const int16_t * samples, long count,
+    int thres)
+{
+	long i, n, l, r, peak, ppeak = 0, max = count / 2 + 1;
+	int * iv;
+	int top;
+
+	if (max > pk->msr_pk_size) {
+		/* Nothing in the old storage is worth copying. */
+		msr_peaks_free (pk);
+		iv = malloc (max * sizeof(int));
+		if (iv == NULL)
+			return (-1);
+		pk->msr_pk_iv = iv;
+		pk->msr_pk_size = max;
+	}
+
+	pk->msr_pk_count = 0;
+	iv = pk->msr_pk_iv;
+
+	i = 0;
+	while (i < count) {
+		/* Skip the silence. */
+		i += msr_pcm_above (samples + i, count - i, thres);
+		if (i == count)
+			break;
+
+		/* Find the top of the run. */
+		n = msr_pcm_below (samples + i, count - i, thres);
+		peak = i + msr_pcm_peak (samples + i, n, &top);
+		i += n;
+
+		/*
+		 * At either end the one neighbour there is stands in for
+		 * the missing one; a lone sample is its own neighbour.
+		 */
+		if (pk->msr_pk_interp) {
+			l = peak > 0 ? peak - 1 : peak + 1;
+			r = peak + 1 < count ? peak + 1 : peak - 1;
+			if (l >= count)
+				l = peak;
+			if (r < 0)
+				r = peak;
+			peak = place (peak, samples[l], samples[peak],
+			    samples[r]);
+		}
+
+		if (peak - ppeak > 0)
+			iv[pk->msr_pk_count++] = (int)(peak - ppeak);
+		ppeak = peak;
+	}
+
+	return (0);
+}
@@ -0,0 +1,115 @@
+#ifndef _BIPHASE_H_
+#define _BIPHASE_H_
+
+/*
+ * Streaming Aiken biphase (F2F) decoder.
+ *
+ * Samples go in a chunk at a time; bits come out as '0' and '1'
+ * characters as soon as the peaks that make them up have been seen.
+ * The decoder never holds on to samples, so its working set is this
+ * structure and nothing else.
+ *
+ * The silence threshold is either fixed, or follows the signal: the
+ * envelope is the loudest sample over the last MSR_BIPHASE_ENV_BLOCKS
+ * blocks of MSR_BIPHASE_ENV_BLOCK samples, and the threshold is a
+ * percentage of it, never below the fixed threshold.
+ */
+
+#define MSR_BIPHASE_ENV_BLOCK	256
+#define MSR_BIPHASE_ENV_BLOCKS	16
+
+/*
+ * Peaks can be placed between samples, by fitting a parabola to the
+ * loudest sample of each run and its neighbours. Positions and
+ * intervals are then counted in 1/MSR_BIPHASE_SUB samples.
+ */
+
+#define MSR_BIPHASE_SUB		256
+
+/* When, and at what speed, a bit went by. */
+typedef struct msr_bittime {
+	long	msr_bt_at;		/* Samples from the first peak */
+	double	msr_bt_period;		/* Samples per bit */
+} msr_bittime_t;
+
+typedef struct msr_biphase {
+	int	msr_bp_thres;		/* Silence threshold */
+	int	msr_bp_freq_thres;	/* Allowed period deviation (pct) */
+
+	/* Envelope follower. */
+	int	msr_bp_adapt;		/* Pct of the envelope, 0 if fixed */
+	int	msr_bp_level;		/* Threshold now in use */
+	int	msr_bp_env[MSR_BIPHASE_ENV_BLOCKS]; /* Block levels */
+	int	msr_bp_envpos;		/* Oldest block level */
+	int	msr_bp_lo;		/* Lowest threshold used above the */
+	int	msr_bp_hi;		/* ... fixed one, and highest */
+
+	/* Peak finder. */
+	long	msr_bp_pos;		/* Index of the next sample */
+	int	msr_bp_inrun;		/* Inside a run above threshold */
+	int	msr_bp_runmax;		/* Largest level in this run */
+	long	msr_bp_runpeak;		/* ... and where it was */
+	long	msr_bp_ppeak;		/* Position of the last peak */
+	int	msr_bp_scale;		/* Position units per sample */
+	int	msr_bp_prev;		/* Last sample of the last chunk */
+	int	msr_bp_left;		/* Samples either side of runpeak */
+	int	msr_bp_right;
+	int	msr_bp_rightdue;	/* ... right is in the next chunk */
+
+	/* Bit decoder. */
+	long	msr_bp_nint;		/* Peak intervals seen */
+	int	msr_bp_zerobl;		/* Current zero bit length */
+	int	msr_bp_follow;		/* ... tracks the swipe speed */
+	int	msr_bp_held;		/* Interval awaiting lookahead */
+	long	msr_bp_nbits;		/* Bits emitted */
+	long	msr_bp_clock;		/* Time since the first peak */
+
+	/* Clock recovery. */
+	int	msr_bp_pll;		/* Loop bandwidth (pct), 0 if off */
+	double	msr_bp_kp;		/* Phase gain */
+	double	msr_bp_ki;		/* Frequency gain */
+	double	msr_bp_acq_kp;		/* ... while locking on */
+	double	msr_bp_acq_ki;
+	double	msr_bp_period;		/* Time per bit */
+	double	msr_bp_phase;		/* Time since the bit began */
+	int	msr_bp_half;		/* Seen the middle of a one */
+
+	/* Bit timing, if wanted. */
+	msr_bittime_t *	msr_bp_times;
+	char *	msr_bp_bits;		/* Start of the caller's bits */
+
+	/* Peak intervals, if wanted. */
+	struct msr_peaks * msr_bp_keep;
+} msr_biphase_t;
+
+/*
+ * Peak intervals of a whole swipe, for decoding a recording that is
+ * already in memory. The storage is kept from swipe to swipe.
+ */
+
+typedef struct msr_peaks {
+	int *	msr_pk_iv;		/* Distance from the previous peak */
+	long	msr_pk_count;
+	long	msr_pk_size;		/* Room in msr_pk_iv */
+	int	msr_pk_interp;		/* Place peaks between samples */
+} msr_peaks_t;
+
+extern void msr_biphase_init (msr_biphase_t *, int, int);
+extern void msr_biphase_reset (msr_biphase_t *);
+extern void msr_biphase_adapt (msr_biphase_t *, int);
+extern void msr_biphase_follow (msr_biphase_t *, int);
+extern void msr_biphase_pll (msr_biphase_t *, int);
+extern void msr_biphase_interp (msr_biphase_t *, int);
+extern void msr_biphase_times (msr_biphase_t *, msr_bittime_t *);
+extern void msr_biphase_keep (msr_biphase_t *, msr_peaks_t *);
+extern int msr_biphase_push (msr_biphase_t *, const int16_t *, int, char *);
+extern int msr_biphase_flush (msr_biphase_t *, char *);
+extern void msr_biphase_levels (msr_biphase_t *, int *, int *);
+extern int msr_biphase_intervals (msr_biphase_t *, const int *, int, char *);
+
+extern void msr_peaks_init (msr_peaks_t *);
+extern void msr_peaks_free (msr_peaks_t *);
+extern int msr_peaks_find (msr_peaks_t *, const int16_t *, long, int);
+extern int msr_peaks_reserve (msr_peaks_t *, long);
+
+#endif /* _BIPHASE_H_ */
@@ -0,0 +1,624 @@
+#include <sys/types.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "capture.h"
+
+/*
+ * Audio capture.
+ *
+ * Reading a sound device one sample per read() costs a system call
+ * for every sample, 192,000 of them a second at dab's default rate.
+ * Instead, a capture thread reads blocks of thousands of samples
+ * straight into a ring buffer, and whoever is looking for swipes
+ * works through the ring a contiguous span at a time. The ring
+ * is lock free: the capture thread only ever moves the head and
+ * the consumer only ever moves the tail. A side that finds the ring
+ * full or empty naps for a millisecond and looks again.
+ *
+ * A live device can't be kept waiting, though: once its own buffer
+ * overruns, the samples are gone anyway, along with the driver's
+ * idea of where it is. With MSR_CAPTURE_DROP, a capture thread that
+ * finds no room for a block reads it and throws it away instead, so
+ * the device is always drained, and counts what it threw away. The
+ * ring keeps the most it ever held, so the consumer can see how close
+ * it came.
+ *
+ * Samples come either from a file descriptor (an OSS device, or
+ * anything else that read() works on), or, when built with HAVE_ALSA,
+ * from an ALSA PCM. ALSA capture maps the driver's own buffer and
+ * copies each period from it into the ring, skipping the extra copy
+ * and the OSS emulation layer that read() on /dev/dsp goes through.
+ */
+
+/* How long a side waits for the other, in milliseconds. */
+#define MSR_CAPTURE_NAP		1
+
+/* How long the ALSA reader waits for a period before checking in. */
+#define MSR_CAPTURE_ALSA_WAIT	100
+
+/* ... and the fd reader for something to read. */
+#define MSR_CAPTURE_FD_WAIT	100
+
+/*
+ * Set up a ring of at least <size> frames of <channels> samples. The
+ * size is rounded up to a power of two.
+ *
+ * This function will fail if memory can't be allocated.
+ */
+
+int
+msr_ring_init (msr_ring_t * rg, uint32_t size, int channels)
+{
+	uint32_t n;
+
+	for (n = 1; n < size && n < 0x80000000; n <<= 1)
+		;
+
+	rg->msr_rg_buf = malloc ((size_t)n * channels * sizeof(int16_t));
+	if (rg->msr_rg_buf == NULL)
+		return (-1);
+	rg->msr_rg_size = n;
+	rg->msr_rg_channels = channels;
+	rg->msr_rg_head = 0;
+	rg->msr_rg_tail = 0;
+	rg->msr_rg_hiwater = 0;
+
+	return (0);
+}
+
+void
+msr_ring_free (msr_ring_t * rg)
+{
+	free (rg->msr_rg_buf);
+	rg->msr_rg_buf = NULL;
+	rg->msr_rg_size = 0;
+}
+
+/*
+ * Producer side: point <span> at the free space following the head and
+ * return how many frames can be written there without wrapping.
+ */
+
+uint32_t
+msr_ring_write_span (msr_ring_t * rg, int16_t ** span)
+{
+	uint32_t head, used, at;
+
+	head = rg->msr_rg_head;
+	used = head - rg->msr_rg_tail;
+	at = head & (rg->msr_rg_size - 1);
+
+	*span = rg->msr_rg_buf + (size_t)at * rg->msr_rg_channels;
+	if (rg->msr_rg_size - used < rg->msr_rg_size - at)
+		return (rg->msr_rg_size - used);
+	return (rg->msr_rg_size - at);
+}
+
+/* Producer side: publish <n> frames written to the last write span. */
+void
+msr_ring_commit (msr_ring_t * rg, uint32_t n)
+{
+	uint32_t used;
+
+	/* The samples must be visible before the new head is. */
+	__sync_synchronize ();
+	rg->msr_rg_head += n;
+
+	used = rg->msr_rg_head - rg->msr_rg_tail;
+	if (used > rg->msr_rg_hiwater)
+		rg->msr_rg_hiwater = used;
+}
+
+/*
+ * Consumer side: point <span> at the oldest frames in the ring and
+ * return how many can be read there without wrapping.
+ */
+
+uint32_t
+msr_ring_read_span (msr_ring_t * rg, const int16_t ** span)
+{
+	uint32_t tail, avail, at;
+
+	tail = rg->msr_rg_tail;
+	avail = rg->msr_rg_head - tail;
+	at = tail & (rg->msr_rg_size - 1);
+
+	/* Don't read samples older than the head we just saw. */
+	__sync_synchronize ();
+
+	*span = rg->msr_rg_buf + (size_t)at * rg->msr_rg_channels;
+	if (avail < rg->msr_rg_size - at)
+		return (avail);
+	return (rg->msr_rg_size - at);
+}
+
+/* How many frames are queued; either side may ask. */
+uint32_t
+msr_ring_used (msr_ring_t * rg)
+{
+	return (rg->msr_rg_head - rg->msr_rg_tail);
+}
+
+/* Consumer side: hand <n> frames from the last read span back. */
+void
+msr_ring_consume (msr_ring_t * rg, uint32_t n)
+{
+	/* We must be done with the samples before they can be reused. */
+	__sync_synchronize ();
+	rg->msr_rg_tail += n;
+}
+
+/*
+ * read() from the capture's file descriptor once poll() says it won't
+ * block, looking in on msr_cp_stop while waiting, so the thread can
+ * always be stopped between blocks. Returns what read() does, or 0 if
+ * asked to stop.
+ */
+
+static ssize_t
+fd_read (msr_capture_t * cp, void * buf, size_t len)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = cp->msr_cp_fd;
+	pfd.events = POLLIN;
+	while (!cp->msr_cp_stop) {
+		r = poll (&pfd, 1, MSR_CAPTURE_FD_WAIT);
+		if (r == -1 && errno != EINTR)
+			return (-1);
+		if (r > 0)
+			return (read (cp->msr_cp_fd, buf, len));
+	}
+
+	return (0);
+}
+
+static void *
+reader (void * arg)
+{
+	msr_capture_t * cp = arg;
+	msr_ring_t * rg = &cp->msr_cp_ring;
+	int16_t * span, * scratch = cp->msr_cp_scratch;
+	uint32_t n;
+	size_t got, frame;
+	ssize_t r;
+	int eof = 0, drop;
+
+	frame = rg->msr_rg_channels * sizeof(int16_t);
+
+	while (!eof && !cp->msr_cp_stop) {
+		n = msr_ring_write_span (rg, &span);
+		drop = scratch != NULL && rg->msr_rg_size - msr_ring_used (rg) <
+		    (uint32_t)cp->msr_cp_block;
+		if (drop) {
+			/* No room for a block: read it anyway, and lose it. */
+			span = scratch;
+			n = cp->msr_cp_block;
+			drop = 1;
+		} else if (n == 0) {
+			/* The consumer has fallen behind. */
+			poll (NULL, 0, MSR_CAPTURE_NAP);
+			continue;
+		}
+		if (n > (uint32_t)cp->msr_cp_block)
+			n = cp->msr_cp_block;
+
+		r = fd_read (cp, span, n * frame);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			if (r == -1)
+				cp->msr_cp_errno = errno;
+			break;
+		}
+
+		/* Never leave part of a frame behind. */
+		got = r;
+		while (got % frame) {
+			r = fd_read (cp, (uint8_t *)span + got, 1);
+			if (r == -1 && errno == EINTR)
+				continue;
+			if (r <= 0) {
+				if (r == -1)
+					cp->msr_cp_errno = errno;
+				got -= got % frame;
+				eof = 1;
+			} else
+				got++;
+		}
+
+		if (drop)
+			cp->msr_cp_dropped += got / frame;
+		else
+			msr_ring_commit (rg, got / frame);
+	}
+
+	__sync_synchronize ();
+	cp->msr_cp_done = 1;
+
+	return (NULL);
+}
+
+static int
+spawn (msr_capture_t * cp, void * (*fn) (void *), int channels,
+    uint32_t size)
+{
+	if (size == 0)
+		size = MSR_CAPTURE_RING;
+	if (size < (uint32_t)cp->msr_cp_block * 2)
+		size = (uint32_t)cp->msr_cp_block * 2;
+
+	cp->msr_cp_stop = 0;
+	cp->msr_cp_done = 0;
+	cp->msr_cp_errno = 0;
+	cp->msr_cp_dropped = 0;
+
+	if (msr_ring_init (&cp->msr_cp_ring, size, channels) == -1)
+		return (-1);
+
+	if (pthread_create (&cp->msr_cp_thread, NULL, fn, cp) != 0) {
+		msr_ring_free (&cp->msr_cp_ring);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Start capturing
+ *
+ * This function starts a thread that reads frames of <channels>
+ * interleaved 16 bit samples from <fd> in blocks of <block> frames
+ * into a ring buffer of at least <size> frames. The device should
+ * already be set up. A <block> or <size> of zero picks the default.
+ * With MSR_CAPTURE_DROP in <flags>, blocks that don't fit in the ring
+ * are dropped rather than left in the device; use it for live input,
+ * and not for files. Several captures, each with a device of its own,
+ * can run at once.
+ *
+ * This function will fail if memory can't be allocated or the thread
+ * can't be started.
+ */
+
+int
+msr_capture_start (msr_capture_t * cp, int fd, int channels, int block,
+    uint32_t size, int flags)
+{
+	if (channels < 1 || channels > MSR_CAPTURE_MAX_CHANNELS)
+		return (-1);
+	if (block <= 0)
+		block = MSR_CAPTURE_BLOCK;
+
+	cp->msr_cp_source = MSR_CAPTURE_FD;
+	cp->msr_cp_fd = fd;
+	cp->msr_cp_pcm = NULL;
+	cp->msr_cp_block = block;
+	cp->msr_cp_flags = flags;
+	cp->msr_cp_scratch = NULL;
+
+	/* Somewhere to read the blocks that are dropped. */
+	if (flags & MSR_CAPTURE_DROP) {
+		cp->msr_cp_scratch = malloc ((size_t)block * channels *
+		    sizeof(int16_t));
+		if (cp->msr_cp_scratch == NULL)
+			return (-1);
+	}
+
+	if (spawn (cp, reader, channels, size) == -1) {
+		free (cp->msr_cp_scratch);
+		cp->msr_cp_scratch = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Stop the capture thread and release the ring. The file descriptor
+ * is left open.
+ */
+
+void
+msr_capture_stop (msr_capture_t * cp)
+{
+	/* Neither reader waits for the device for long before noticing. */
+	cp->msr_cp_stop = 1;
+	pthread_join (cp->msr_cp_thread, NULL);
+
+	msr_ring_free (&cp->msr_cp_ring);
+	free (cp->msr_cp_scratch);
+	cp->msr_cp_scratch = NULL;
+}
+
+/*
+ * Wait for captured samples
+ *
+ * This function points <span> at the oldest frames that haven't been
+ * consumed yet and returns how many of them are contiguous, waiting
+ * for the capture thread if there are none. The frames stay in the
+ * ring until they are passed to msr_capture_consume().
+ *
+ * This function returns 0 once the input has ended and every frame
+ * has been consumed.
+ */
+
+int
+msr_capture_span (msr_capture_t * cp, const int16_t ** span)
+{
+	uint32_t n;
+	int done;
+
+	while (1) {
+		/* Check for the end first, so no late samples are missed. */
+		done = cp->msr_cp_done;
+		__sync_synchronize ();
+		n = msr_ring_read_span (&cp->msr_cp_ring, span);
+		if (n > 0 || done)
+			return ((int)n);
+		poll (NULL, 0, MSR_CAPTURE_NAP);
+	}
+}
+
+void
+msr_capture_consume (msr_capture_t * cp, int n)
+{
+	msr_ring_consume (&cp->msr_cp_ring, (uint32_t)n);
+}
+
+#ifdef HAVE_ALSA
+
+/*
+ * Open an ALSA PCM for capture
+ *
+ * This function opens the capture device named in <cfg> for signed
+ * 16 bit, interleaved, memory mapped capture of the number of channels
+ * asked for (one, if that is zero), as close to the rate, period and
+ * buffer sizes asked for as the device will go, and stores the ones
+ * it got back in <cfg>. The "null" device, or one end of the
+ * snd-aloop loopback card, will do in place of a sound card.
+ *
+ * This function returns the PCM, or NULL with the reason stored in
+ * <cfg>->msr_ac_error.
+ */
+
+void *
+msr_alsa_open (msr_alsa_config_t * cfg)
+{
+	snd_pcm_t * pcm;
+	snd_pcm_hw_params_t * hw = NULL;
+	snd_pcm_sw_params_t * sw = NULL;
+	snd_pcm_uframes_t period, buffer;
+	unsigned int rate, channels;
+	int err;
+
+	channels = cfg->msr_ac_channels ? cfg->msr_ac_channels : 1;
+	if (channels > MSR_CAPTURE_MAX_CHANNELS) {
+		cfg->msr_ac_error = "Too many channels";
+		return (NULL);
+	}
+
+	err = snd_pcm_open (&pcm, cfg->msr_ac_device, SND_PCM_STREAM_CAPTURE, 0);
+	if (err < 0) {
+		cfg->msr_ac_error = snd_strerror (err);
+		return (NULL);
+	}
+
+	if ((err = snd_pcm_hw_params_malloc (&hw)) < 0 ||
+	    (err = snd_pcm_hw_params_any (pcm, hw)) < 0 ||
+	    (err = snd_pcm_hw_params_set_access (pcm, hw,
+	    SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format (pcm, hw,
+	    SND_PCM_FORMAT_S16_LE)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels (pcm, hw, channels)) < 0)
+		goto fail;
+
+	rate = cfg->msr_ac_rate;
+	if ((err = snd_pcm_hw_params_set_rate_near (pcm, hw, &rate, 0)) < 0)
+		goto fail;
+	period = cfg->msr_ac_period;
+	if (period != 0 && (err = snd_pcm_hw_params_set_period_size_near (pcm,
+	    hw, &period, 0)) < 0)
+		goto fail;
+	buffer = cfg->msr_ac_buffer;
+	if (buffer != 0 && (err = snd_pcm_hw_params_set_buffer_size_near (pcm,
+	    hw, &buffer)) < 0)
+		goto fail;
+	if ((err = snd_pcm_hw_params (pcm, hw)) < 0)
+		goto fail;
+
+	/* Wake the reader once a whole period is in. */
+	if ((err = snd_pcm_sw_params_malloc (&sw)) < 0 ||
+	    (err = snd_pcm_sw_params_current (pcm, sw)) < 0 ||
+	    (period != 0 &&
+	    (err = snd_pcm_sw_params_set_avail_min (pcm, sw, period)) < 0) ||
+	    (err = snd_pcm_sw_params (pcm, sw)) < 0 ||
+	    (err = snd_pcm_prepare (pcm)) < 0)
+		goto fail;
+
+	snd_pcm_hw_params_free (hw);
+	snd_pcm_sw_params_free (sw);
+
+	cfg->msr_ac_rate = rate;
+	cfg->msr_ac_channels = channels;
+	cfg->msr_ac_period = period;
+	cfg->msr_ac_buffer = buffer;
+	cfg->msr_ac_error = NULL;
+
+	return (pcm);
+
+fail:
+	if (hw != NULL)
+		snd_pcm_hw_params_free (hw);
+	if (sw != NULL)
+		snd_pcm_sw_params_free (sw);
+	snd_pcm_close (pcm);
+	cfg->msr_ac_error = snd_strerror (err);
+
+	return (NULL);
+}
+
+void
+msr_alsa_close (void * pcm)
+{
+	snd_pcm_close (pcm);
+}
+
+/*
+ * Copy what the device has captured out of its mapped buffer and into
+ * the ring, dropping what doesn't fit if we may. Returns the number of
+ * frames taken from the device, or an ALSA error.
+ */
+
+static snd_pcm_sframes_t
+alsa_copy (msr_capture_t * cp, snd_pcm_uframes_t avail)
+{
+	snd_pcm_t * pcm = cp->msr_cp_pcm;
+	const snd_pcm_channel_area_t * areas;
+	snd_pcm_uframes_t offset, frames, done;
+	const int16_t * src;
+	int16_t * span;
+	uint32_t n;
+	int err, ch = cp->msr_cp_ring.msr_rg_channels;
+
+	frames = avail;
+	if ((err = snd_pcm_mmap_begin (pcm, &areas, &offset, &frames)) < 0)
+		return (err);
+
+	src = (const int16_t *)((const uint8_t *)areas[0].addr +
+	    (areas[0].first + offset * areas[0].step) / 8);
+
+	/* The ring may need two goes, if it wraps. */
+	for (done = 0; done < frames; done += n) {
+		n = msr_ring_write_span (&cp->msr_cp_ring, &span);
+		if (n == 0)
+			break;
+		if (n > frames - done)
+			n = frames - done;
+		memcpy (span, src + done * ch, n * ch * sizeof(int16_t));
+		msr_ring_commit (&cp->msr_cp_ring, n);
+	}
+
+	if (done < frames && (cp->msr_cp_flags & MSR_CAPTURE_DROP)) {
+		cp->msr_cp_dropped += frames - done;
+		done = frames;
+	}
+
+	return (snd_pcm_mmap_commit (pcm, offset, done));
+}
+
+static void *
+alsa_reader (void * arg)
+{
+	msr_capture_t * cp = arg;
+	snd_pcm_t * pcm = cp->msr_cp_pcm;
+	snd_pcm_sframes_t avail, r;
+	int16_t * span;
+
+	if ((r = snd_pcm_start (pcm)) < 0)
+		goto out;
+
+	while (!cp->msr_cp_stop) {
+		if (!(cp->msr_cp_flags & MSR_CAPTURE_DROP) &&
+		    msr_ring_write_span (&cp->msr_cp_ring, &span) == 0) {
+			/* The consumer has fallen behind. */
+			poll (NULL, 0, MSR_CAPTURE_NAP);
+			continue;
+		}
+
+		avail = snd_pcm_avail_update (pcm);
+		if (avail >= 0 && avail < cp->msr_cp_block) {
+			r = snd_pcm_wait (pcm, MSR_CAPTURE_ALSA_WAIT);
+			if (r >= 0)
+				continue;
+			avail = r;
+		}
+		if (avail >= 0)
+			avail = alsa_copy (cp, avail);
+
+		/* Overruns and suspends are survivable; start again. */
+		if (avail < 0) {
+			if ((r = snd_pcm_recover (pcm, (int)avail, 1)) < 0 ||
+			    (r = snd_pcm_start (pcm)) < 0)
+				goto out;
+		}
+	}
+	r = 0;
+
+out:
+	if (r < 0)
+		cp->msr_cp_errno = (int)-r;
+	snd_pcm_drop (pcm);
+	__sync_synchronize ();
+	cp->msr_cp_done = 1;
+
+	return (NULL);
+}
+
+/*
+ * Start capturing from an ALSA PCM opened with msr_alsa_open() for
+ * <channels> channels, into a ring of at least <size> frames (zero
+ * for the default), with <flags> as for msr_capture_start(). The PCM
+ * is left open when the capture is stopped.
+ *
+ * This function will fail if memory can't be allocated or the thread
+ * can't be started.
+ */
+
+int
+msr_capture_start_alsa (msr_capture_t * cp, void * pcm, int channels,
+    uint32_t size, int flags)
+{
+	snd_pcm_uframes_t buffer, period;
+
+	if (channels < 1 || channels > MSR_CAPTURE_MAX_CHANNELS)
+		return (-1);
+
+	cp->msr_cp_source = MSR_CAPTURE_ALSA;
+	cp->msr_cp_fd = -1;
+	cp->msr_cp_pcm = pcm;
+	cp->msr_cp_flags = flags;
+	cp->msr_cp_scratch = NULL;
+
+	/* Take whatever has come in once there is a period's worth. */
+	cp->msr_cp_block = MSR_CAPTURE_BLOCK;
+	if (snd_pcm_get_params (pcm, &buffer, &period) == 0 && period > 0)
+		cp->msr_cp_block = period;
+
+	return (spawn (cp, alsa_reader, channels, size));
+}
+
+#else /* HAVE_ALSA */
+
+void *
+msr_alsa_open (msr_alsa_config_t * cfg)
+{
+	cfg->msr_ac_error = "ALSA support not built in";
+	return (NULL);
+}
+
+void
+msr_alsa_close (void * pcm)
+{
+}
+
+int
+msr_capture_start_alsa (msr_capture_t * cp, void * pcm, int channels,
+    uint32_t size, int flags)
+{
+	return (-1);
+}
+
+#endif /* HAVE_ALSA */
@@ -0,0 +1,85 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <pthread.h>
+
+/*
+ * Single producer, single consumer ring of frames of interleaved 16
+ * bit samples, one per channel. The head and tail count frames, and
+ * only ever count up; the buffer index is the count modulo the size,
+ * which must be a power of two.
+ */
+
+typedef struct msr_ring {
+	int16_t *		msr_rg_buf;
+	uint32_t		msr_rg_size;	/* In frames */
+	int			msr_rg_channels;
+	volatile uint32_t	msr_rg_head;	/* Written by the producer */
+	volatile uint32_t	msr_rg_tail;	/* Written by the consumer */
+	volatile uint32_t	msr_rg_hiwater;	/* Most frames ever queued */
+} msr_ring_t;
+
+/* Defaults, in frames. */
+#define MSR_CAPTURE_BLOCK	4096
+#define MSR_CAPTURE_RING	(1 << 20)
+
+/* Where the samples come from. */
+#define MSR_CAPTURE_FD		0	/* OSS device, pipe or file */
+#define MSR_CAPTURE_ALSA	1	/* ALSA PCM, through mmap */
+
+/* Capture flags. */
+#define MSR_CAPTURE_DROP	0x01	/* Drop blocks, never wait, if full */
+
+/* Most channels we capture at once. */
+#define MSR_CAPTURE_MAX_CHANNELS	8
+
+/* ALSA device set up. Zero sizes leave the choice to ALSA. */
+typedef struct msr_alsa_config {
+	const char *		msr_ac_device;	/* PCM name, eg. "hw:0" */
+	unsigned int		msr_ac_rate;
+	unsigned int		msr_ac_channels;
+	unsigned long		msr_ac_period;	/* Frames per period */
+	unsigned long		msr_ac_buffer;	/* Frames in the buffer */
+	const char *		msr_ac_error;	/* Why the open failed */
+} msr_alsa_config_t;
+
+/*
+ * Audio capture. A thread of its own takes big blocks from the
+ * device straight into the ring, and the caller takes them out of
+ * it a span at a time.
+ */
+
+typedef struct msr_capture {
+	int			msr_cp_source;
+	int			msr_cp_fd;
+	void *			msr_cp_pcm;	/* snd_pcm_t, for ALSA */
+	int			msr_cp_block;	/* Frames per read() */
+	int			msr_cp_flags;
+	int16_t *		msr_cp_scratch;	/* Dropped blocks go here */
+	msr_ring_t		msr_cp_ring;
+	pthread_t		msr_cp_thread;
+	volatile int		msr_cp_stop;	/* Asked to stop */
+	volatile int		msr_cp_done;	/* End of input or error */
+	int			msr_cp_errno;
+	volatile unsigned long	msr_cp_dropped;	/* Frames lost to a full ring */
+} msr_capture_t;
+
+extern int msr_ring_init (msr_ring_t *, uint32_t, int);
+extern void msr_ring_free (msr_ring_t *);
+extern uint32_t msr_ring_write_span (msr_ring_t *, int16_t **);
+extern void msr_ring_commit (msr_ring_t *, uint32_t);
+extern uint32_t msr_ring_read_span (msr_ring_t *, const int16_t **);
+extern void msr_ring_consume (msr_ring_t *, uint32_t);
+extern uint32_t msr_ring_used (msr_ring_t *);
+
+extern int msr_capture_start (msr_capture_t *, int, int, int, uint32_t, int);
+extern int msr_capture_start_alsa (msr_capture_t *, void *, int, uint32_t,
+    int);
+extern void msr_capture_stop (msr_capture_t *);
+extern int msr_capture_span (msr_capture_t *, const int16_t **);
+extern void msr_capture_consume (msr_capture_t *, int);
+
+extern void * msr_alsa_open (msr_alsa_config_t *);
+extern void msr_alsa_close (void *);
+
+#endif /* _CAPTURE_H_ */
@@ -0,0 +1,263 @@
+#include <sys/types.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmsr.h"
+
+/*
+ * Multi-swipe consensus.
+ *
+ * Reads of the same card differ from swipe to swipe: the number of
+ * leading clocking zeros changes, and worn spots flip a bit here and
+ * there. Given several raw captures of the same track, we line them
+ * up against the first one, then vote on every bit. Votes from
+ * characters that pass parity, and from swipes whose LRC checks,
+ * count for more than votes from characters we already know are bad.
+ */
+
+/* How far either side of the start sentinel we search for a better fit. */
+#define MSR_CONSENSUS_WINDOW	16
+
+/* Vote weights. */
+#define MSR_VOTE_BASE		1
+#define MSR_VOTE_PARITY		1	/* Character passes parity */
+#define MSR_VOTE_LRC		1	/* Whole swipe passes LRC */
+
+#define B2(n)	n, n + 1, n + 1, n + 2
+#define B4(n)	B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
+#define B6(n)	B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
+
+static const uint8_t popcount[256] = { B6(0), B6(1), B6(1), B6(2) };
+
+/* Return the 8 bits of <buf> starting at bit <bit>, which may be negative. */
+static uint8_t
+getbyte (const uint8_t * buf, int len, int bit)
+{
+	int byte = bit >> 3;
+	int shift = bit & 7;
+	uint8_t hi = 0, lo = 0;
+
+	if (byte >= 0 && byte < len)
+		hi = buf[byte];
+	if (byte + 1 >= 0 && byte + 1 < len)
+		lo = buf[byte + 1];
+
+	if (shift == 0)
+		return (hi);
+	return ((hi << shift) | (lo >> (8 - shift)));
+}
+
+static int
+getbit (const uint8_t * buf, int bit)
+{
+	return ((buf[bit >> 3] >> (7 - (bit & 7))) & 1);
+}
+
+/* Return the position of the first set bit in <buf>, or -1. */
+static int
+firstbit (const uint8_t * buf, int len)
+{
+	int i, b;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] == 0)
+			continue;
+		for (b = 0; !(buf[i] & (0x80 >> b)); b++)
+			;
+		return (i * 8 + b);
+	}
+
+	return (-1);
+}
+
+/*
+ * Shifted copies of a swipe, one per sub-byte bit offset, so that
+ * trying a new alignment is a byte lookup rather than a bit shuffle.
+ * Entry [r][k + 1] holds the 8 bits starting at bit 8 * k + r.
+ */
+
+typedef struct msr_shifted {
+	uint8_t		msr_sh_data[8][MSR_MAX_TRACK_LEN + 2];
+	int		msr_sh_len;
+} msr_shifted_t;
+
+static void
+shift_init (msr_shifted_t * sh, const uint8_t * buf, int len)
+{
+	int r, k;
+
+	for (r = 0; r < 8; r++)
+		for (k = -1; k <= len; k++)
+			sh->msr_sh_data[r][k + 1] = getbyte (buf, len, 8 * k + r);
+	sh->msr_sh_len = len;
+}
+
+/*
+ * Count the set bits <ref> and the swipe in <sh> have in common when
+ * the swipe is moved <shift> bits towards the start of the track.
+ */
+
+static int
+correlate (const uint8_t * ref, int reflen, const msr_shifted_t * sh,
+    int shift)
+{
+	const uint8_t * d;
+	int q, i, first, last, n = 0;
+
+	/* Floor division, so the remainder is always a valid row. */
+	q = shift >= 0 ? shift / 8 : -((7 - shift) / 8);
+	d = sh->msr_sh_data[shift - 8 * q];
+
+	first = -1 - q > 0 ? -1 - q : 0;
+	last = sh->msr_sh_len - q < reflen - 1 ? sh->msr_sh_len - q : reflen - 1;
+	for (i = first; i <= last; i++)
+		n += popcount[ref[i] & d[i + q + 1]];
+
+	return (n);
+}
+
+/*
+ * Work out, per character, whether an aligned swipe passes parity,
+ * and whether the swipe as a whole passes its LRC check. Characters
+ * are framed from bit <start>. Only the ISO widths have an end
+ * sentinel to find the LRC by.
+ */
+
+static int
+check (const uint8_t * buf, int len, int start, int bpc, uint8_t * good)
+{
+	uint8_t chars[MSR_MAX_TRACK_BITS / MSR_INFER_MIN_BPC];
+	int nchars, i, k;
+
+	nchars = (len * 8 - start) / bpc;
+	for (i = 0; i < nchars; i++) {
+		chars[i] = 0;
+		for (k = 0; k < bpc; k++)
+			chars[i] |= getbit (buf, start + i * bpc + k) << k;
+		good[i] = msr_parity (chars[i]);
+	}
+
+	if (bpc != MSR_ABA_BPC && bpc != MSR_IATA_BPC)
+		return (0);
+
+	return ((msr_check_chars (chars, nchars, bpc, NULL) &
+	    MSR_VALID_LRC) != 0);
+}
+
+/*
+ * Build one track out of several swipes of the same card
+ *
+ * This function takes track number <track> from each of the <nswipes>
+ * raw reads in <swipes>, aligns them bit by bit against the first
+ * one, and stores the majority vote of every bit in <out>. Votes
+ * are weighted up for characters of <bpc> bits that pass parity and
+ * for swipes that pass their LRC check; a <bpc> of zero disables
+ * the weighting for tracks with no character framing. If <confidence>
+ * is not NULL, it receives one value per output bit, from 127 (a
+ * tied vote) to 255 (a unanimous one). It must have room for
+ * MSR_MAX_TRACK_BITS entries.
+ *
+ * This function returns the number of swipes that took part in the
+ * vote. It will fail if there are no swipes, more than MSR_MAX_SWIPES
+ * swipes, or if the first swipe has no data on the requested track.
+ */
+
+int
+msr_consensus_track (msr_tracks_t * swipes, int nswipes, int track, int bpc,
+    msr_track_t * out, uint8_t * confidence)
+{
+	uint8_t aligned[MSR_MAX_SWIPES][MSR_MAX_TRACK_LEN];
+	uint8_t good[MSR_MAX_SWIPES][MSR_MAX_TRACK_BITS / MSR_INFER_MIN_BPC];
+	int lrc_ok[MSR_MAX_SWIPES];
+	msr_shifted_t sh;
+	msr_track_t * ref, * t;
+	int refstart, start, shift, best, bestshift, n, len, outlen;
+	int i, j, s, w0, w1, w;
+
+	if (swipes == NULL || out == NULL || nswipes < 1 ||
+	    nswipes > MSR_MAX_SWIPES || track < 0 || track >= MSR_MAX_TRACKS)
+		return (-1);
+	if (bpc != 0 && (bpc < MSR_INFER_MIN_BPC || bpc > MSR_INFER_MAX_BPC))
+		return (-1);
+
+	ref = &swipes[0].msr_tracks[track];
+	refstart = firstbit (ref->msr_tk_data, ref->msr_tk_len);
+	if (refstart == -1)
+		return (-1);
+
+	/*
+	 * Line up each swipe against the reference. The start sentinel
+	 * gets us close; cross-correlation around it does the rest.
+	 */
+
+	outlen = ref->msr_tk_len;
+	for (n = 0, j = 0; j < nswipes; j++) {
+		t = &swipes[j].msr_tracks[track];
+		start = firstbit (t->msr_tk_data, t->msr_tk_len);
+		if (start == -1)
+			continue;
+
+		shift_init (&sh, t->msr_tk_data, t->msr_tk_len);
+		best = -1;
+		bestshift = 0;
+		for (shift = start - refstart - MSR_CONSENSUS_WINDOW;
+		    shift <= start - refstart + MSR_CONSENSUS_WINDOW; shift++) {
+			s = correlate (ref->msr_tk_data, ref->msr_tk_len,
+			    &sh, shift);
+			if (s > best) {
+				best = s;
+				bestshift = shift;
+			}
+		}
+
+		len = (t->msr_tk_len * 8 - bestshift + 7) / 8;
+		if (len > outlen)
+			outlen = len;
+		if (outlen > MSR_MAX_TRACK_LEN)
+			outlen = MSR_MAX_TRACK_LEN;
+
+		for (i = 0; i < MSR_MAX_TRACK_LEN; i++)
+			aligned[n][i] = getbyte (t->msr_tk_data, t->msr_tk_len,
+			    bestshift + i * 8);
+		n++;
+	}
+
+	for (j = 0; j < n; j++) {
+		memset (good[j], 0, sizeof(good[j]));
+		lrc_ok[j] = 0;
+		if (bpc)
+			lrc_ok[j] = check (aligned[j], outlen, refstart, bpc,
+			    good[j]);
+	}
+
+	/* Vote. Ties go to the reference swipe. */
+	memset (out->msr_tk_data, 0, sizeof(out->msr_tk_data));
+	out->msr_tk_len = outlen;
+	for (i = 0; i < outlen * 8; i++) {
+		w0 = w1 = 0;
+		for (j = 0; j < n; j++) {
+			w = MSR_VOTE_BASE;
+			if (bpc && i >= refstart) {
+				if (good[j][(i - refstart) / bpc])
+					w += MSR_VOTE_PARITY;
+				if (lrc_ok[j])
+					w += MSR_VOTE_LRC;
+			}
+			if (getbit (aligned[j], i))
+				w1 += w;
+			else
+				w0 += w;
+		}
+
+		if (w1 > w0 || (w1 == w0 && getbit (aligned[0], i)))
+			out->msr_tk_data[i >> 3] |= 0x80 >> (i & 7);
+		if (confidence != NULL)
+			confidence[i] = 255 * (w1 > w0 ? w1 : w0) / (w0 + w1);
+	}
+
+	return (n);
+}
@@ -48,40 +48,151 @@
           fixed potential segmentation fault (Ed W.)
    
    Compiling:
-     cc dab.c -o dab -lsndfile
+     make libmsr.a
+     cc dab.c -o dab -L. -lmsr -lpthread -lsndfile
 */
 
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <sndfile.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/soundcard.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "biphase.h"
+#include "capture.h"
+#include "parallel.h"
+#include "pcm.h"
+#include "pcmmap.h"
+#include "segment.h"
+#include "viterbi.h"
+
 /*** defaults ***/
 #define DEVICE        "/dev/dsp" /* default sound card device */
+#define ALSA_DEVICE   "default"  /* default ALSA capture device */
 #define SAMPLE_RATE   192000     /* default sample rate (hz) */
 #define SILENCE_THRES 5000       /* initial silence threshold */
 /*** end defaults ***/
 
-/* #define DISABLE_VC */
-
 #define AUTO_THRES    30    /* pct of highest value to set silence_thres to */
 #define BUF_SIZE      1024  /* buffer size */
+#define LINE_SIZE     4096  /* longest file name in a batch list */
 #define END_LENGTH    200   /* msec of silence to determine end of sample */
 #define FREQ_THRES    60    /* frequency threshold (pct) */
+#define INTERP_RATE   96000 /* place peaks between samples below this rate */
 #define MAX_TERM      60    /* sec before termination of print_max_level() */
+#define PLL_BW        10    /* suggested PLL loop bandwidth (pct) */
+#define VITERBI_BPC   5     /* suggested character size for -V */
 #define VERSION       "0.7" /* version */
 
+#define DRIVER_OSS    0     /* capture through /dev/dsp */
+#define DRIVER_ALSA   1     /* capture through ALSA */
+
 
 short int *sample = NULL;
 int sample_size = 0;
+int sample_channels = 1;
+
+msr_pcmmap_t sample_map;          /* file the sample is mapped from */
+int sample_mapped = 0;            /* sample points into sample_map if true */
+
+FILE *timing = NULL;              /* per-bit timing goes here, if anywhere */
+int swipe = 0;                    /* swipes seen, for the timing */
+msr_bittime_t bit_times[BUF_SIZE];
+
+
+/* how to decode every track of a sample */
+typedef struct {
+  int freq_thres;    /* frequency threshold */
+  int silence_thres; /* silence threshold, or 0 to set one for each track */
+  int auto_thres;    /* pct of each track's highest value */
+  int adapt;         /* pct of each track's recent level, or 0 */
+  int pll;           /* clock recovery loop bandwidth (pct), or 0 */
+  int interp;        /* place peaks between samples at any sample rate */
+  int bpc;           /* bits per character to decode by likelihood, or -1 */
+  int timed;         /* record when each bit went by if true */
+} params_t;
+
+
+/* one track of a multi-channel sample, decoded on a thread of its own */
+typedef struct {
+  pthread_t thread;
+  const short int *sample; /* interleaved sample the track is in */
+  int size;          /* number of frames in sample */
+  int channels;      /* number of channels in sample */
+  int channel;       /* which channel of the sample */
+  int freq_thres;    /* frequency threshold */
+  int silence_thres; /* silence threshold, or 0 to set it from auto_thres */
+  int auto_thres;    /* pct of the track's highest value */
+  int adapt;         /* pct of the track's recent level, or 0 */
+  int thres_hi;      /* highest threshold used when adapting */
+  int pll;           /* clock recovery loop bandwidth (pct), or 0 */
+  int interp;        /* place peaks between samples if true */
+  int bpc;           /* bits per character to decode by likelihood, or -1 */
+  int timed;         /* record when each bit went by if true */
+  msr_bittime_t *times;
+  short int *samples;
+  msr_peaks_t peaks;
+  char *bits;
+  int nbits;         /* bits decoded, or -1 if no data was detected */
+} track_t;
+
+
+/* items of work, each decoded on whichever thread of a pool picks it up,
+   with a line for each printed in the order the items were given */
+typedef struct {
+  int count;         /* number of items */
+  /* decodes an item, adding the samples read and whether it could not be
+     read; returns its line, empty if there is nothing to print */
+  char *(*decode)(void *arg, int n, double *samples, int *failed);
+  void *arg;         /* what the items are in */
+  pthread_mutex_t lock; /* protects what follows */
+  char **lines;      /* results not yet printed */
+  int next;          /* next result to print */
+  int printed;       /* lines printed */
+  int failed;        /* items that could not be read */
+  double samples;    /* samples read, over all channels */
+} pool_t;
+
+
+/* a batch of recordings, one item of a pool each */
+typedef struct {
+  char **names;      /* files to decode */
+  int count;         /* number of files */
+  params_t params;   /* how to decode them */
+  int raw_channels;  /* number of channels in a raw file */
+  int raw_rate;      /* sample rate of a raw file */
+} batch_t;
+
+
+/* one swipe of a long recording */
+typedef struct {
+  long start;        /* first frame of the swipe */
+  long end;          /* frame after its end */
+} swipe_t;
+
+
+/* a long recording of any number of swipes, each found by the silence
+   around it and an item of a pool */
+typedef struct {
+  const short int *sample; /* interleaved recording */
+  long size;         /* number of frames in it */
+  int channels;      /* number of channels in it */
+  int rate;          /* sample rate */
+  swipe_t *swipes;   /* swipes found */
+  int count;         /* number of swipes */
+  params_t params;   /* how to decode them */
+} session_t;
 
 
 
@@ -138,24 +249,6 @@ char *xstrdup(char *string)
 }
 
 
-/* read with error checking
-   [fd]            file descriptor to read from
-   [buf]           buffer
-   [count]         bytes to read
-   returns         bytes read */
-ssize_t xread(int fd, void *buf, size_t count)
-{
-  int retval;
-  
-  retval = read(fd, buf, count);
-  if (retval == -1) {
-    perror("read()");
-    exit(EXIT_FAILURE);
-  }
-  
-  return retval;
-}
-
 /********** end function wrappers **********/
 
 
@@ -184,17 +277,54 @@ void print_help(FILE *stream, char *exec)
   fprintf(stream, "\nUsage: %s [OPTIONS]\n\n", exec);
   fprintf(stream, "  -a,  --auto-thres   Set auto-thres percentage\n");
   fprintf(stream, "                      (default: %d)\n", AUTO_THRES);
+  fprintf(stream, "  -A,  --adaptive     Keep the threshold at auto-thres pct of\n");
+  fprintf(stream, "                      the recent level, decoding as the\n");
+  fprintf(stream, "                      sample comes in (-t sets the floor)\n");
+  fprintf(stream, "  -b,  --batch        Decode every file in a directory, or\n");
+  fprintf(stream, "                      listed in a file (- for stdin), a line\n");
+  fprintf(stream, "                      each: name, then each track's bits,\n");
+  fprintf(stream, "                      tab separated\n");
+  fprintf(stream, "  -B,  --buffer       ALSA buffer size in frames\n");
+  fprintf(stream, "                      (default: chosen by ALSA)\n");
+  fprintf(stream, "  -c,  --channels     Channels to record, one track each\n");
+  fprintf(stream, "                      (default: 1, files use their own)\n");
   fprintf(stream, "  -d,  --device       Device to read audio data from\n");
-  fprintf(stream, "                      (default: %s)\n", DEVICE);
+  fprintf(stream, "                      (default: %s, or %s for ALSA)\n",
+          DEVICE, ALSA_DEVICE);
+  fprintf(stream, "  -D,  --driver       Capture driver, oss or alsa\n");
+  fprintf(stream, "                      (default: oss)\n");
   fprintf(stream, "  -f,  --file         File to read audio data from\n");
   fprintf(stream, "                      (use instead of -d)\n");
   fprintf(stream, "  -h,  --help         Print help information\n");
+  fprintf(stream, "  -i,  --interpolate  Place peaks between samples\n");
+  fprintf(stream, "                      (default: below %d hz)\n", INTERP_RATE);
+  fprintf(stream, "  -j,  --jobs         Threads to decode a batch or session on\n");
+  fprintf(stream, "                      (default: one per CPU)\n");
+  fprintf(stream, "  -l,  --loop         Keep decoding swipes until the input ends\n");
+  fprintf(stream, "                      (devices only)\n");
+  fprintf(stream, "  -L,  --pll          Recover the bit clock with a PLL of this\n");
+  fprintf(stream, "                      loop bandwidth (pct of the bit rate)\n");
+  fprintf(stream, "                      (default: off; try %d)\n", PLL_BW);
   fprintf(stream, "  -m,  --max-level    Shows the maximum level\n");
   fprintf(stream, "                      (use to determine threshold)\n");
+  fprintf(stream, "  -P,  --period       ALSA period size in frames\n");
+  fprintf(stream, "                      (default: chosen by ALSA)\n");
+  fprintf(stream, "  -r,  --rate         Sample rate to record at\n");
+  fprintf(stream, "                      (default: %d)\n", SAMPLE_RATE);
   fprintf(stream, "  -s,  --silent       No verbose messages\n");
+  fprintf(stream, "  -S,  --session      Find every swipe in a long file (-f) by\n");
+  fprintf(stream, "                      the silence between them, a line each:\n");
+  fprintf(stream, "                      start and end (sec), then each track's\n");
+  fprintf(stream, "                      bits, tab separated\n");
   fprintf(stream, "  -t,  --threshold    Set silence threshold\n");
   fprintf(stream, "                      (default: automatic detect)\n");
+  fprintf(stream, "  -T,  --timing       File to write the timing of each bit to\n");
   fprintf(stream, "  -v,  --version      Print version information\n");
+  fprintf(stream, "  -V,  --viterbi      Decode each swipe as a whole, taking the\n");
+  fprintf(stream, "                      most likely bits, with characters of\n");
+  fprintf(stream, "                      this many bits and odd parity (0 if not\n");
+  fprintf(stream, "                      known) (default: off; try %d)\n",
+          VITERBI_BPC);
 }
 
 /********** end version functions **********/
@@ -203,13 +333,47 @@ void print_help(FILE *stream, char *exec)
 
 
 
+/********** output functions **********/
+
+/* prints decoded bits, and when each went by if that is wanted
+   [bits]          bits
+   [n]             number of bits
+   [times]         timing of each bit
+   [track]         track the bits are from
+   [first]         number of the first bit in the swipe
+   ** global **
+   [timing]        file to write the timing to, or NULL
+   [swipe]         number of the swipe */
+void put_bits(const char *bits, int n, const msr_bittime_t *times, int track,
+              long first)
+{
+  int i;
+  
+  fwrite(bits, 1, n, stdout);
+  if (timing == NULL)
+    return;
+  
+  /* swipe, track, bit number, bit, sample it ended on, samples per bit */
+  for (i = 0; i < n; i++)
+    fprintf(timing, "%d %d %ld %c %ld %.2f\n", swipe, track, first + i,
+            bits[i], times[i].msr_bt_at, times[i].msr_bt_period);
+}
+
+/********** end output functions **********/
+
+
+
+
+
 /********** dsp functions **********/
 
 /* sets the device parameters
    [fd]            file descriptor to set ioctls on
+   [channels]      number of channels to record
+   [rate]          sample rate to ask for
    [verbose]       prints verbose messages if true
    returns         sample rate */
-int dsp_init(int fd, int verbose)
+int dsp_init(int fd, int channels, int rate, int verbose)
 {
   int ch, fmt, sr;
   
@@ -231,57 +395,118 @@ int dsp_init(int fd, int verbose)
   
   /* set audio channels */
   if (verbose)
-    fprintf(stderr, "    Channels: 1\n");
-  ch = 0;
-  if (ioctl(fd, SNDCTL_DSP_STEREO, &ch) == -1) {
-    perror("SNDCTL_DSP_STEREO");
+    fprintf(stderr, "    Channels: %d\n", channels);
+  ch = channels;
+  if (ioctl(fd, SNDCTL_DSP_CHANNELS, &ch) == -1) {
+    perror("SNDCTL_DSP_CHANNELS");
     exit(EXIT_FAILURE);
   }
-  if (ch != 0) {
-    fprintf(stderr, "*** Error: Device does not support monaural recording\n");
+  if (ch != channels) {
+    fprintf(stderr, "*** Error: Device does not support %d channel recording\n",
+            channels);
     exit(EXIT_FAILURE);
   }
   
   /* set sample rate */
   if (verbose)
-    fprintf(stderr, "    Sample rate: %d\n", SAMPLE_RATE);
-  sr = SAMPLE_RATE;
+    fprintf(stderr, "    Sample rate: %d\n", rate);
+  sr = rate;
   if (ioctl(fd, SNDCTL_DSP_SPEED, &sr) == -1) {
     perror("SNDCTL_DSP_SPEED");
     exit(EXIT_FAILURE);
   }
-  if (sr != SAMPLE_RATE)
+  if (sr != rate)
     fprintf(stderr, "*** Warning: Highest supported sample rate is %d\n", sr);
   
   return sr;
 }
 
 
+/* opens an ALSA capture device and starts capturing from it
+   [cap]           capture to start
+   [device]        ALSA PCM name
+   [channels]      number of channels to record
+   [rate]          sample rate to ask for
+   [period]        period size in frames (0 lets ALSA choose)
+   [buffer]        buffer size in frames (0 lets ALSA choose)
+   [verbose]       prints verbose messages if true
+   returns         sample rate */
+int alsa_init(msr_capture_t *cap, char *device, int channels, int rate,
+              int period, int buffer, int verbose)
+{
+  msr_alsa_config_t cfg;
+  void *pcm;
+  
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.msr_ac_device = device;
+  cfg.msr_ac_rate = rate;
+  cfg.msr_ac_channels = channels;
+  cfg.msr_ac_period = period;
+  cfg.msr_ac_buffer = buffer;
+  
+  pcm = msr_alsa_open(&cfg);
+  if (pcm == NULL) {
+    fprintf(stderr, "*** Error: %s: %s\n", device, cfg.msr_ac_error);
+    exit(EXIT_FAILURE);
+  }
+  
+  if (verbose) {
+    fprintf(stderr, "*** Setting ALSA capture parameters:\n");
+    fprintf(stderr, "    Format: S16_LE, mmap\n");
+    fprintf(stderr, "    Channels: %u\n", cfg.msr_ac_channels);
+    fprintf(stderr, "    Sample rate: %u\n", cfg.msr_ac_rate);
+    fprintf(stderr, "    Period: %lu frames\n", cfg.msr_ac_period);
+    fprintf(stderr, "    Buffer: %lu frames\n", cfg.msr_ac_buffer);
+  }
+  if (cfg.msr_ac_rate != (unsigned int)rate)
+    fprintf(stderr, "*** Warning: Highest supported sample rate is %u\n",
+            cfg.msr_ac_rate);
+  
+  if (msr_capture_start_alsa(cap, pcm, channels, 0, MSR_CAPTURE_DROP) == -1) {
+    fprintf(stderr, "*** Error: Could not start audio capture\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  return cfg.msr_ac_rate;
+}
+
+
+/* stops capturing, closing the ALSA device if there is one
+   [cap]           capture to stop */
+void stop_capture(msr_capture_t *cap)
+{
+  msr_capture_stop(cap);
+  if (cap->msr_cp_source == MSR_CAPTURE_ALSA)
+    msr_alsa_close(cap->msr_cp_pcm);
+}
+
+
 /* prints the maximum dsp level to aid in setting the silence threshold
-   [fd]            file descriptor to read from
+   [cap]           capture to read from
    [sample_rate]   sample rate of device */
-void print_max_level(int fd, int sample_rate)
+void print_max_level(msr_capture_t *cap, int sample_rate)
 {
-  int i;
-  short int buf, last = 0;
+  const int16_t *span;
+  int ch, n, left, level, last = 0;
   
+  ch = cap->msr_cp_ring.msr_rg_channels;
   printf("Terminating after %d seconds...\n", MAX_TERM);
   
-  for (i = 0; i < sample_rate * MAX_TERM; i++) {
-    
-    /* read from fd */
-    xread(fd, &buf, sizeof (short int));
-    
-    /* take absolute value */
-    if (buf < 0)
-      buf = -buf;
+  left = sample_rate * MAX_TERM;
+  while (left > 0 && (n = msr_capture_span(cap, &span)) > 0) {
+    if (n > left)
+      n = left;
     
     /* print if highest level */
-    if (buf > last) {
-      printf("Maximum level: %d\r", buf);
+    level = msr_pcm_absmax(span, n * ch);
+    if (level > last) {
+      printf("Maximum level: %d\r", level);
       fflush(stdout);
-      last = buf;
+      last = level;
     }
+    
+    msr_capture_consume(cap, n);
+    left -= n;
   }
   
   printf("\n");
@@ -291,81 +516,143 @@ void print_max_level(int fd, int sample_rate)
 /* finds the maximum value in sample
    ** global **
    [sample]        sample
-   [sample_size]   number of frames in sample */
+   [sample_size]   number of frames in sample
+   [sample_channels] number of channels in sample */
 short int evaluate_max(void)
 {
-  int i;
-  short int max = 0;
+  int max;
   
-  for (i = 0; i < sample_size; i++) {
-    if (sample[i] > max)
-       max = sample[i];
-  }
+  max = msr_pcm_max(sample, (long)sample_size * sample_channels);
+  
+  return max > 0 ? max : 0;
+}
+
+
+/* prints how full the capture queue is and has been, and what was dropped
+   [cap]           capture to report on */
+void print_capture_stats(msr_capture_t *cap)
+{
+  msr_ring_t *rg = &cap->msr_cp_ring;
   
-  return max;
+  fprintf(stderr, "*** Capture queue: %lu frames queued, %lu at most (of %lu), "
+          "%lu dropped\n", (unsigned long)msr_ring_used(rg),
+          (unsigned long)rg->msr_rg_hiwater, (unsigned long)rg->msr_rg_size,
+          cap->msr_cp_dropped);
 }
 
 
 /* pauses until the dsp level is above the silence threshold
-   [fd]            file descriptor to read from
-   [silence_thres] silence threshold */
-void silence_pause(int fd, int silence_thres)
+   [cap]           capture to read from
+   [silence_thres] silence threshold
+   returns         0 if the input ended first, 1 otherwise */
+int silence_pause(msr_capture_t *cap, int silence_thres)
 {
-  short int buf = 0;
+  const int16_t *span;
+  int ch, i, n;
   
-  /* loop while silent */
-  while (buf < silence_thres) {
-    
-    /* read from fd */
-    xread(fd, &buf, sizeof (short int));
-    
-    /* absolute value */
-    if (buf < 0)
-      buf = -buf;
+  ch = cap->msr_cp_ring.msr_rg_channels;
+  
+  /* loop while silent on every channel */
+  while ((n = msr_capture_span(cap, &span)) > 0) {
+    i = msr_pcm_above(span, n * ch, silence_thres - 1);
+    if (i < n * ch) {
+      msr_capture_consume(cap, i / ch + 1);
+      return 1;
+    }
+    msr_capture_consume(cap, n);
   }
+  
+  return 0;
 }
 
 
 /* gets a sample, terminating when the input goes below the silence threshold
-   [fd]            file descriptor to read from
+   on every channel
+   [cap]           capture to read from
    [sample_rate]   sample rate of device
    [silence_thres] silence threshold
    ** global **
-   [sample]        sample
-   [sample_size]   number of frames in sample */
-void get_dsp(int fd, int sample_rate, int silence_thres)
+   [sample]        sample, with the channels interleaved
+   [sample_size]   number of frames in sample
+   [sample_channels] number of channels in sample
+   returns         -1 if the input ended before the sample began, 0 otherwise */
+int get_dsp(msr_capture_t *cap, int sample_rate, int silence_thres)
 {
-  int count = 0, eos = 0, i;
-  short buf;
+  msr_segment_t sg;
+  const int16_t *span;
+  int ch, n, room = 0;
   
+  ch = sample_channels = cap->msr_cp_ring.msr_rg_channels;
   sample_size = 0;
   
   /* wait for sample */
-  silence_pause(fd, silence_thres);
-  
-  while (!eos) {
-    /* fill buffer */
-    sample = xrealloc(sample, sizeof (short int) * (BUF_SIZE * (count + 1)));
-    for (i = 0; i < BUF_SIZE; i++) {
-      xread(fd, &buf, sizeof (short int));
-      sample[i + (count * BUF_SIZE)] = buf;
+  if (!silence_pause(cap, silence_thres))
+    return -1;
+  
+  /* the end is END_LENGTH msec of silence, counted as it comes in */
+  msr_segment_init(&sg, silence_thres, ch,
+                   (long)sample_rate * END_LENGTH / 1000);
+  msr_segment_begin(&sg);
+  
+  while (!sg.msr_sg_ready && (n = msr_capture_span(cap, &span)) > 0) {
+    n = msr_segment_push(&sg, span, n);
+    
+    /* fill buffer, growing it by doubling */
+    if (sample_size + n > room) {
+      while (sample_size + n > room)
+        room = room ? room * 2 : BUF_SIZE;
+      sample = xrealloc(sample, sizeof (short int) * room * ch);
     }
-    count++;
-    sample_size = count * BUF_SIZE;
+    memcpy(sample + sample_size * ch, span, sizeof (short int) * n * ch);
+    msr_capture_consume(cap, n);
+    sample_size += n;
+  }
+  
+  return 0;
+}
+
+
+/* decodes a sample while it is being read, terminating when the input goes
+   below the silence threshold
+   [cap]           capture to read from
+   [sample_rate]   sample rate of device
+   [bp]            decoder, set up with the silence and frequency thresholds
+   returns         number of bits decoded, or -1 if the input ended before
+                   the sample began */
+long stream_dsp(msr_capture_t *cap, int sample_rate, msr_biphase_t *bp)
+{
+  msr_segment_t sg;
+  const int16_t *span;
+  int i, n;
+  char bits[BUF_SIZE];
+  
+  /* wait for sample */
+  if (!silence_pause(cap, bp->msr_bp_thres))
+    return -1;
+  
+  /* the end is END_LENGTH msec of silence, counted as it comes in */
+  msr_segment_init(&sg, bp->msr_bp_thres, 1,
+                   (long)sample_rate * END_LENGTH / 1000);
+  msr_segment_begin(&sg);
+  
+  while (!sg.msr_sg_ready) {
+    /* decode straight out of the ring, a block at a time */
+    n = msr_capture_span(cap, &span);
+    if (n == 0)
+      break;
+    if (n > BUF_SIZE)
+      n = BUF_SIZE;
+    n = msr_segment_push(&sg, span, n);
     
-    /* check for silence */
-    eos = 1;
-    if (sample_size > (sample_rate * END_LENGTH) / 1000) {
-      for (i = 0; i < (sample_rate * END_LENGTH) / 1000; i++)  {
-        buf = sample[(count * BUF_SIZE) - i - 1];
-        if (buf < 0)
-          buf = -buf;
-        if (buf > silence_thres)
-          eos = 0;
-      }
-    } else
-      eos = 0;
+    /* decode while the card is still moving */
+    i = msr_biphase_push(bp, span, n, bits);
+    put_bits(bits, i, bit_times, 1, bp->msr_bp_nbits - i);
+    fflush(stdout);
+    
+    msr_capture_consume(cap, n);
   }
+  
+  return bp->msr_bp_nbits;
 }
 
 /********** end dsp functions **********/
@@ -376,12 +663,104 @@ void get_dsp(int fd, int sample_rate, int silence_thres)
 
 /********** begin sndfile functions **********/
 
+/* is the file raw samples, with no header? goes by the name
+   [filename]    name of the file
+   returns       1 for a .raw or .pcm file, 0 otherwise */
+int is_raw(char *filename)
+{
+  char *ext = strrchr(filename, '.');
+  
+  return ext != NULL && (!strcmp(ext, ".raw") || !strcmp(ext, ".pcm"));
+}
+
+
+/* maps a 16 bit WAV or raw file, so its samples can be decoded in place
+   [filename]    file to map
+   [channels]    number of channels in a raw file
+   [rate]        set to the sample rate of a WAV file
+   [verbose]     verbosity flag
+   ** global **
+   [sample_map]  map of the file
+   [sample_mapped] set if the file is mapped
+   [sample_size] number of frames in the file
+   [sample_channels] number of channels in the file
+   returns       0 if the file is mapped, -1 if it has to go through
+                 libsndfile */
+int map_file(char *filename, int channels, int *rate, int verbose)
+{
+  if (msr_pcmmap_open(&sample_map, filename,
+                      is_raw(filename) ? channels : 0) == -1) {
+    /* libsndfile doesn't know about headerless files */
+    if (is_raw(filename)) {
+      fprintf(stderr, "*** Error: %s: %s\n", filename,
+              sample_map.msr_pm_error);
+      exit(EXIT_FAILURE);
+    }
+    if (verbose)
+      fprintf(stderr, "*** Reading through libsndfile: %s\n",
+              sample_map.msr_pm_error);
+    return -1;
+  }
+  
+  if (!sample_map.msr_pm_raw)
+    *rate = sample_map.msr_pm_rate;
+  
+  /* print some statistics */
+  if (verbose) {
+    fprintf(stderr, "*** Input file format (mapped):\n"
+            "    Frames: %li\n"
+            "    Sample Rate: %i\n"
+            "    Channels: %i\n"
+            "    Format: %s\n",
+            sample_map.msr_pm_frames, *rate, sample_map.msr_pm_channels,
+            sample_map.msr_pm_raw ? "raw S16_LE" : "WAV S16_LE");
+  }
+  
+  /* each channel is decoded as a track of its own */
+  if (sample_map.msr_pm_channels > MSR_CAPTURE_MAX_CHANNELS) {
+    fprintf(stderr, "*** Error: Only files of 1 to %d channels are supported\n",
+            MSR_CAPTURE_MAX_CHANNELS);
+    exit(EXIT_FAILURE);
+  }
+  
+  sample_mapped = 1;
+  sample_size = sample_map.msr_pm_frames;
+  sample_channels = sample_map.msr_pm_channels;
+  
+  return 0;
+}
+
+
+/* decodes a mapped file straight from the map, a buffer at a time
+   [bp]          decoder, set up with the silence and frequency thresholds
+   ** global **
+   [sample_map]  map of the file
+   returns       number of bits decoded */
+long stream_map(msr_biphase_t *bp)
+{
+  const int16_t *data = sample_map.msr_pm_data;
+  long i, count = sample_map.msr_pm_frames;
+  char bits[BUF_SIZE];
+  int n;
+  
+  for (i = 0; i < count; i += BUF_SIZE) {
+    n = msr_biphase_push(bp, data + i,
+                         count - i < BUF_SIZE ? count - i : BUF_SIZE, bits);
+    put_bits(bits, n, bit_times, 1, bp->msr_bp_nbits - n);
+  }
+  
+  return bp->msr_bp_nbits;
+}
+
+
 /* open the file
    [fd]          file to open
+   [rate]        set to the sample rate of the file
    [verbose]     verbosity flag
    ** global **
-   [sample_size] number of frames in the file */
-SNDFILE *sndfile_init(int fd, int verbose)
+   [sample_size] number of frames in the file
+   [sample_channels] number of channels in the file */
+SNDFILE *sndfile_init(int fd, int *rate, int verbose)
 {
   SNDFILE *sndfile;
   SF_INFO sfinfo;
@@ -409,14 +788,17 @@ SNDFILE *sndfile_init(int fd, int verbose)
             sfinfo.format, sfinfo.sections, sfinfo.seekable);
   }
   
-  /* ensure that the file is monaural */
-  if (sfinfo.channels != 1) {
-    fprintf(stderr, "*** Error: Only monaural files are supported\n");
+  /* each channel is decoded as a track of its own */
+  if (sfinfo.channels < 1 || sfinfo.channels > MSR_CAPTURE_MAX_CHANNELS) {
+    fprintf(stderr, "*** Error: Only files of 1 to %d channels are supported\n",
+            MSR_CAPTURE_MAX_CHANNELS);
     exit(EXIT_FAILURE);
   }
   
   /* set sample size */
   sample_size = sfinfo.frames;
+  sample_channels = sfinfo.channels;
+  *rate = sfinfo.samplerate;
   
   return sndfile;
 }
@@ -425,17 +807,18 @@ SNDFILE *sndfile_init(int fd, int verbose)
 /* read in data from libsndfile
    [sndfile]     SNDFILE pointer from sf_open() or sf_open_fd()
    ** global **
-   [sample]      sample
-   [sample_size] number of frames in sample */
+   [sample]      sample, with the channels interleaved
+   [sample_size] number of frames in sample
+   [sample_channels] number of channels in sample */
 void get_sndfile(SNDFILE *sndfile)
 {
   sf_count_t count;
   
   /* allocate memory for sample */
-  sample = xmalloc(sizeof(short int) * sample_size);
+  sample = xmalloc(sizeof(short int) * sample_size * sample_channels);
   
   /* read in sample */
-  count = sf_read_short(sndfile, sample, sample_size);
+  count = sf_readf_short(sndfile, sample, sample_size);
   if (count != sample_size) {
     fprintf(stderr, "*** Warning: expected %i frames, read %i.\n",
             sample_size, (int)count);
@@ -443,6 +826,26 @@ void get_sndfile(SNDFILE *sndfile)
   }
 }
 
+
+/* decodes data from libsndfile a buffer at a time
+   [sndfile]     SNDFILE pointer from sf_open() or sf_open_fd()
+   [bp]          decoder, set up with the silence and frequency thresholds
+   returns       number of bits decoded */
+long stream_sndfile(SNDFILE *sndfile, msr_biphase_t *bp)
+{
+  sf_count_t count;
+  short int buf[BUF_SIZE];
+  char bits[BUF_SIZE];
+  int n;
+  
+  while ((count = sf_read_short(sndfile, buf, BUF_SIZE)) > 0) {
+    n = msr_biphase_push(bp, buf, (int)count, bits);
+    put_bits(bits, n, bit_times, 1, bp->msr_bp_nbits - n);
+  }
+  
+  return bp->msr_bp_nbits;
+}
+
 /********** end sndfile functions **********/
 
 
@@ -451,69 +854,669 @@ void get_sndfile(SNDFILE *sndfile)
 
 /* decodes aiken biphase and prints binary
    [freq_thres]    frequency threshold
+   [silence_thres] silence threshold
+   [pll]           clock recovery loop bandwidth (pct), or 0
+   [bpc]           bits per character to decode by likelihood, or -1
+   [peaks]         peak storage, kept from one swipe to the next
    ** global **
    [sample]        sample
-   [sample_size]   number of frames in sample */
-void decode_aiken_biphase(int freq_thres, int silence_thres)
+   [sample_size]   number of frames in sample
+   returns         -1 if no data was detected, 0 otherwise */
+int decode_aiken_biphase(int freq_thres, int silence_thres, int pll, int bpc,
+                         msr_peaks_t *peaks)
 {
-  int i = 0, peak = 0, ppeak = 0;
-  int *peaks = NULL, peaks_size = 0;
-  int zerobl;
-  
-  /* absolute value */
-  for (i = 0; i < sample_size; i++)
-    if (sample[i] < 0)
-      sample[i] = -sample[i];
+  msr_biphase_t bp;
+  msr_viterbi_t vt;
+  char bits[BUF_SIZE], *all;
+  long i;
+  int m, n;
   
   /* store peak differences */
-  i = 0;
-  while (i < sample_size) {
-    /* old peak value */
-    ppeak = peak;
-    /* find peaks */
-    while (i < sample_size && sample[i] <= silence_thres)
-      i++;
-    peak = 0;
-    while (i < sample_size && sample[i] > silence_thres) {
-      if (sample[i] > sample[peak])
-        peak = i;
-      i++;
-    }
-    if (peak - ppeak > 0) {
-      peaks = xrealloc(peaks, sizeof(int) * (peaks_size + 1));
-      peaks[peaks_size] = peak - ppeak;
-      peaks_size++;
-    }
+  if (msr_peaks_find(peaks, sample, sample_size, silence_thres) == -1) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
   }
   
   /* decode aiken biphase allowing for
      frequency deviation based on freq_thres */
   /* ignore first two peaks and last peak */
-  if (peaks_size < 2) {
-    fprintf(stderr, "*** Error: No data detected\n");
+  if (peaks->msr_pk_count < 3)
+    return -1;
+  
+  /* weigh every reading of the whole swipe instead */
+  if (bpc >= 0) {
+    all = xmalloc(2 * peaks->msr_pk_count);
+    msr_viterbi_init(&vt);
+    i = msr_viterbi_decode(&vt, peaks->msr_pk_iv, peaks->msr_pk_count, bpc,
+                           all);
+    if (i == -1) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    put_bits(all, (int)i, NULL, 1, 0);
+    printf("\n");
+    msr_viterbi_free(&vt);
+    free(all);
+    return 0;
+  }
+  
+  msr_biphase_init(&bp, silence_thres, freq_thres);
+  if (pll)
+    msr_biphase_pll(&bp, pll);
+  msr_biphase_interp(&bp, peaks->msr_pk_interp);
+  msr_biphase_times(&bp, bit_times);
+  for (i = 0; i < peaks->msr_pk_count; i += m) {
+    m = peaks->msr_pk_count - i < BUF_SIZE ? peaks->msr_pk_count - i : BUF_SIZE;
+    n = msr_biphase_intervals(&bp, peaks->msr_pk_iv + i, m, bits);
+    put_bits(bits, n, bit_times, 1, bp.msr_bp_nbits - n);
+  }
+  printf("\n");
+  
+  return 0;
+}
+
+
+/* decodes one track of a multi-channel sample; everything it works on is
+   in the track_t, so any number of them can run at once
+   [arg]           track_t to decode */
+void *decode_track(void *arg)
+{
+  track_t *t = arg;
+  msr_biphase_t bp;
+  msr_viterbi_t vt;
+  long nbits;
+  int i, n, max, size = t->size;
+  
+  msr_pcm_deinterleave(t->sample, size, t->channels, t->channel, t->samples);
+  
+  /* follow the track's level as it goes, the same as a streamed decode */
+  if (t->adapt) {
+    t->bits = xmalloc(size + 1);
+    if (t->timed)
+      t->times = xmalloc(sizeof (msr_bittime_t) * (size + 1));
+    msr_biphase_init(&bp, t->silence_thres, t->freq_thres);
+    msr_biphase_adapt(&bp, t->adapt);
+    if (t->pll)
+      msr_biphase_pll(&bp, t->pll);
+    msr_biphase_interp(&bp, t->interp);
+    for (i = 0, n = 0; i < size; i += BUF_SIZE) {
+      msr_biphase_times(&bp, t->times ? t->times + n : NULL);
+      n += msr_biphase_push(&bp, t->samples + i,
+                            size - i < BUF_SIZE ? size - i : BUF_SIZE,
+                            t->bits + n);
+    }
+    msr_biphase_times(&bp, t->times ? t->times + n : NULL);
+    n += msr_biphase_flush(&bp, t->bits + n);
+    msr_biphase_levels(&bp, &t->silence_thres, &t->thres_hi);
+    t->nbits = bp.msr_bp_nint < 3 ? -1 : n;
+    return NULL;
+  }
+  
+  /* each head has a level of its own */
+  if (!t->silence_thres) {
+    max = msr_pcm_max(t->samples, size);
+    t->silence_thres = t->auto_thres * (max > 0 ? max : 0) / 100;
+  }
+  
+  t->nbits = -1;
+  if (msr_peaks_find(&t->peaks, t->samples, size, t->silence_thres) == -1) {
+    fprintf(stderr, "Out of memory.\n");
     exit(EXIT_FAILURE);
   }
-  zerobl = peaks[2];
-  for (i = 2; i < peaks_size - 1; i++) {
-    if (peaks[i] < ((zerobl / 2) + (freq_thres * (zerobl / 2) / 100)) &&
-        peaks[i] > ((zerobl / 2) - (freq_thres * (zerobl / 2) / 100))) {
-      if (peaks[i + 1] < ((zerobl / 2) + (freq_thres * (zerobl / 2) / 100)) &&
-          peaks[i + 1] > ((zerobl / 2) - (freq_thres * (zerobl / 2) / 100))) {
-        printf("1");
-        zerobl = peaks[i] * 2;
-        i++;
-      }
-    } else if (peaks[i] < (zerobl + (freq_thres * zerobl / 100)) &&
-               peaks[i] > (zerobl - (freq_thres * zerobl / 100))) {
-      printf("0");
-#ifndef DISABLE_VC
-      zerobl = peaks[i];
-#endif
+  if (t->peaks.msr_pk_count < 3)
+    return NULL;
+  
+  /* a bit cell may have been read as up to two intervals too few */
+  if (t->bpc >= 0) {
+    t->bits = xmalloc(2 * t->peaks.msr_pk_count);
+    msr_viterbi_init(&vt);
+    nbits = msr_viterbi_decode(&vt, t->peaks.msr_pk_iv, t->peaks.msr_pk_count,
+                               t->bpc, t->bits);
+    if (nbits == -1) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    msr_viterbi_free(&vt);
+    t->nbits = (int)nbits;
+    return NULL;
+  }
+  
+  t->bits = xmalloc(t->peaks.msr_pk_count);
+  if (t->timed)
+    t->times = xmalloc(sizeof (msr_bittime_t) * t->peaks.msr_pk_count);
+  msr_biphase_init(&bp, t->silence_thres, t->freq_thres);
+  if (t->pll)
+    msr_biphase_pll(&bp, t->pll);
+  msr_biphase_interp(&bp, t->interp);
+  msr_biphase_times(&bp, t->times);
+  t->nbits = msr_biphase_intervals(&bp, t->peaks.msr_pk_iv,
+                                   t->peaks.msr_pk_count, t->bits);
+  
+  return NULL;
+}
+
+
+/* decodes every track of a span of interleaved frames, one after another,
+   or all at once on a thread each; the tracks are to be freed with
+   free_span()
+   [tracks]        set to the decoded tracks, one per channel
+   [sample]        first frame of the span
+   [size]          number of frames in the span
+   [channels]      number of channels in the sample
+   [rate]          sample rate
+   [p]             how to decode the tracks
+   [threaded]      decodes the tracks on a thread each if true
+   returns         number of tracks with bits */
+int decode_span(track_t *tracks, const short int *sample, int size,
+                int channels, int rate, const params_t *p, int threaded)
+{
+  int i, found = 0;
+  
+  for (i = 0; i < channels; i++) {
+    memset(&tracks[i], 0, sizeof (track_t));
+    tracks[i].sample = sample;
+    tracks[i].size = size;
+    tracks[i].channels = channels;
+    tracks[i].channel = i;
+    tracks[i].freq_thres = p->freq_thres;
+    tracks[i].silence_thres = p->silence_thres;
+    tracks[i].auto_thres = p->auto_thres;
+    tracks[i].adapt = p->adapt;
+    tracks[i].pll = p->pll;
+    /* at low sample rates a sample is a good part of a bit */
+    tracks[i].interp = p->interp || rate < INTERP_RATE;
+    tracks[i].bpc = p->bpc;
+    tracks[i].timed = p->timed;
+    tracks[i].samples = xmalloc(sizeof (short int) * (size + 1));
+    msr_peaks_init(&tracks[i].peaks);
+    tracks[i].peaks.msr_pk_interp = tracks[i].interp;
+    if (!threaded)
+      decode_track(&tracks[i]);
+    else if (pthread_create(&tracks[i].thread, NULL, decode_track,
+                            &tracks[i])) {
+      fprintf(stderr, "*** Error: Could not start decoding thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  
+  for (i = 0; i < channels; i++) {
+    if (threaded)
+      pthread_join(tracks[i].thread, NULL);
+    if (tracks[i].nbits > 0)
+      found++;
+  }
+  
+  return found;
+}
+
+
+/* frees the tracks of a span
+   [tracks]        tracks set by decode_span()
+   [channels]      number of tracks */
+void free_span(track_t *tracks, int channels)
+{
+  int i;
+  
+  for (i = 0; i < channels; i++) {
+    free(tracks[i].bits);
+    free(tracks[i].times);
+    free(tracks[i].samples);
+    msr_peaks_free(&tracks[i].peaks);
+  }
+}
+
+
+/* puts the bits of every track of a span on a line, after a prefix, tab
+   separated, and frees the tracks
+   [tracks]        tracks set by decode_span()
+   [channels]      number of tracks
+   [prefix]        start of the line
+   returns         line */
+char *span_line(track_t *tracks, int channels, const char *prefix)
+{
+  char *line, *p;
+  size_t len;
+  int i;
+  
+  len = strlen(prefix) + 1;
+  for (i = 0; i < channels; i++)
+    len += 1 + (tracks[i].nbits > 0 ? tracks[i].nbits : 0);
+  
+  line = p = xmalloc(len);
+  strcpy(p, prefix);
+  p += strlen(prefix);
+  for (i = 0; i < channels; i++) {
+    *p++ = '\t';
+    if (tracks[i].nbits > 0) {
+      memcpy(p, tracks[i].bits, tracks[i].nbits);
+      p += tracks[i].nbits;
+    }
+    *p = '\0';
+  }
+  free_span(tracks, channels);
+  
+  return line;
+}
+
+
+/* decodes every track of a multi-channel sample at once, one thread per
+   channel, and prints the binary of each on a line of its own, in channel
+   order; a track with no data gives an empty line
+   [p]             how to decode the tracks
+   [rate]          sample rate
+   [verbose]       prints verbose messages if true
+   ** global **
+   [sample]        sample
+   [sample_size]   number of frames in sample
+   [sample_channels] number of channels in sample
+   returns         -1 if no data was detected on any track, 0 otherwise */
+int decode_tracks(const params_t *p, int rate, int verbose)
+{
+  track_t tracks[MSR_CAPTURE_MAX_CHANNELS];
+  int i, found = 0;
+  
+  decode_span(tracks, sample, sample_size, sample_channels, rate, p, 1);
+  
+  for (i = 0; i < sample_channels; i++) {
+    if (verbose && p->adapt)
+      fprintf(stderr, "*** Track %d silence threshold: %d to %d\n", i + 1,
+              tracks[i].silence_thres, tracks[i].thres_hi);
+    else if (verbose)
+      fprintf(stderr, "*** Track %d silence threshold: %d\n", i + 1,
+              tracks[i].silence_thres);
+    if (tracks[i].nbits == -1) {
+      if (verbose)
+        fprintf(stderr, "*** Warning: No data detected on track %d\n", i + 1);
+    } else {
+      put_bits(tracks[i].bits, tracks[i].nbits, tracks[i].times, i + 1, 0);
+      found = 1;
     }
+    printf("\n");
   }
+  free_span(tracks, sample_channels);
+  
+  return found ? 0 : -1;
+}
+
+
+/* finishes off a streamed decode and ends the line of bits
+   [bp]            decoder used for the sample
+   returns         -1 if no data was detected, 0 otherwise */
+int finish_biphase(msr_biphase_t *bp)
+{
+  char bits[1];
+  int n;
+  
+  n = msr_biphase_flush(bp, bits);
+  
+  /* nothing is decoded until the first two peaks have gone by */
+  if (bp->msr_bp_nint < 3)
+    return -1;
+  
+  put_bits(bits, n, bit_times, 1, bp->msr_bp_nbits - n);
   printf("\n");
   
-} 
+  return 0;
+}
+
+
+
+
+
+/********** pool functions **********/
+
+/* decodes one item of a pool, and prints the results of as many items as
+   are now ready, in order
+   [arg]           pool_t the item is in
+   [n]             index of the item */
+void run_item(void *arg, int n)
+{
+  pool_t *pl = arg;
+  double samples = 0;
+  int failed = 0;
+  char *line;
+  
+  line = pl->decode(pl->arg, n, &samples, &failed);
+  
+  pthread_mutex_lock(&pl->lock);
+  pl->lines[n] = line;
+  pl->failed += failed;
+  pl->samples += samples;
+  while (pl->next < pl->count && pl->lines[pl->next] != NULL) {
+    if (*pl->lines[pl->next]) {
+      printf("%s\n", pl->lines[pl->next]);
+      pl->printed++;
+    }
+    free(pl->lines[pl->next]);
+    pl->next++;
+  }
+  pthread_mutex_unlock(&pl->lock);
+}
+
+
+/* decodes the items of a pool on a pool of threads, printing their lines
+   in order
+   [pl]            pool, with the items and how to decode them set
+   [nthreads]      number of threads, or 0 for one per CPU
+   [secs]          set to the time taken, in seconds
+   returns         number of threads used */
+int run_pool(pool_t *pl, int nthreads, double *secs)
+{
+  struct timeval start, end;
+  
+  pl->lines = xmalloc(sizeof (char *) * (pl->count + 1));
+  memset(pl->lines, 0, sizeof (char *) * (pl->count + 1));
+  pl->next = 0;
+  pl->printed = 0;
+  pl->failed = 0;
+  pl->samples = 0;
+  pthread_mutex_init(&pl->lock, NULL);
+  
+  gettimeofday(&start, NULL);
+  /* an item is a lot of work; hand them out one at a time */
+  nthreads = msr_parallel_chunked(pl->count, nthreads, 1, run_item, pl);
+  gettimeofday(&end, NULL);
+  fflush(stdout);
+  
+  *secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  if (*secs <= 0)
+    *secs = 1e-6;
+  
+  pthread_mutex_destroy(&pl->lock);
+  free(pl->lines);
+  
+  return nthreads;
+}
+
+/********** end pool functions **********/
+
+
+
+
+
+/********** batch functions **********/
+
+/* compares two file names for qsort()
+   [a]             pointer to the first name
+   [b]             pointer to the second name
+   returns         <0, 0 or >0 as with strcmp() */
+int compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* adds a file name to a list
+   [names]         list of names
+   [count]         number of names in the list, incremented
+   [name]          name to add
+   returns         list, moved if it had to grow */
+char **add_name(char **names, int *count, char *name)
+{
+  /* grow by doubling */
+  if ((*count & (*count - 1)) == 0)
+    names = xrealloc(names, sizeof (char *) * (*count ? *count * 2 : 1));
+  names[(*count)++] = xstrdup(name);
+  
+  return names;
+}
+
+
+/* lists the files to decode in a batch: every file in a directory, in name
+   order, or the names listed one per line in a file ("-" for stdin)
+   [path]          directory or list
+   [count]         set to the number of files
+   returns         list of file names */
+char **load_batch(char *path, int *count)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct stat st;
+  FILE *list;
+  char **names = NULL, *name, line[LINE_SIZE];
+  size_t len;
+  
+  *count = 0;
+  
+  if (strcmp(path, "-") && stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+    if ((dir = opendir(path)) == NULL) {
+      perror(path);
+      exit(EXIT_FAILURE);
+    }
+    while ((de = readdir(dir)) != NULL) {
+      /* skip hidden files, and anything that isn't a file */
+      if (de->d_name[0] == '.')
+        continue;
+      name = xmalloc(strlen(path) + strlen(de->d_name) + 2);
+      sprintf(name, "%s/%s", path, de->d_name);
+      if (stat(name, &st) == 0 && S_ISREG(st.st_mode))
+        names = add_name(names, count, name);
+      free(name);
+    }
+    closedir(dir);
+    
+    /* readdir() order is no order at all */
+    if (*count > 1)
+      qsort(names, *count, sizeof (char *), compare_names);
+    return names;
+  }
+  
+  if (!strcmp(path, "-"))
+    list = stdin;
+  else if ((list = fopen(path, "r")) == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof (line), list) != NULL) {
+    len = strlen(line);
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (len > 0)
+      names = add_name(names, count, line);
+  }
+  if (list != stdin)
+    fclose(list);
+  
+  return names;
+}
+
+
+/* decodes one file of a batch, every track of it
+   [arg]           batch_t the file is in
+   [n]             index of the file in the batch
+   [samples]       increased by the samples read, over all channels
+   [failed]        set if the file could not be read
+   returns         the file name, then the bits of each track, tab separated */
+char *decode_file(void *arg, int n, double *samples, int *failed)
+{
+  batch_t *b = arg;
+  track_t tracks[MSR_CAPTURE_MAX_CHANNELS];
+  msr_pcmmap_t map;
+  SNDFILE *sndfile = NULL;
+  SF_INFO sfinfo;
+  short int *frames = NULL;
+  const short int *data = NULL;
+  char *name = b->names[n], *line;
+  int size = 0, channels = 0, rate = b->raw_rate;
+  
+  /* map the file if we can, or read the whole of it if we can't; nothing
+     here is shared with other files */
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  if (msr_pcmmap_open(&map, name, is_raw(name) ? b->raw_channels : 0) == 0) {
+    data = map.msr_pm_data;
+    size = map.msr_pm_frames;
+    channels = map.msr_pm_channels;
+    if (!map.msr_pm_raw)
+      rate = map.msr_pm_rate;
+  } else if (is_raw(name)) {
+    fprintf(stderr, "*** Error: %s: %s\n", name, map.msr_pm_error);
+    *failed = 1;
+  } else if ((sndfile = sf_open(name, SFM_READ, &sfinfo)) == NULL) {
+    fprintf(stderr, "*** Error: %s: %s\n", name, sf_strerror(NULL));
+    *failed = 1;
+  } else {
+    channels = sfinfo.channels;
+    rate = sfinfo.samplerate;
+    if (channels >= 1 && channels <= MSR_CAPTURE_MAX_CHANNELS) {
+      data = frames = xmalloc(sizeof (short int) *
+                              ((size_t)sfinfo.frames + 1) * channels);
+      size = (int)sf_readf_short(sndfile, frames, sfinfo.frames);
+    }
+    sf_close(sndfile);
+  }
+  if (channels > MSR_CAPTURE_MAX_CHANNELS || (!*failed && channels < 1)) {
+    fprintf(stderr, "*** Error: %s: Only files of 1 to %d channels are "
+            "supported\n", name, MSR_CAPTURE_MAX_CHANNELS);
+    channels = 0;
+    *failed = 1;
+  }
+  
+  /* decode each track in turn; the pool is already busy */
+  decode_span(tracks, data, size, channels, rate, &b->params, 0);
+  line = span_line(tracks, channels, name);
+  if (data != NULL && frames == NULL)
+    msr_pcmmap_close(&map);
+  free(frames);
+  
+  *samples += (double)size * channels;
+  
+  return line;
+}
+
+
+/* decodes a batch of files on a pool of threads, printing a line for each
+   file: its name, then the binary of each track, tab separated; a file that
+   could not be read gets a line with just its name
+   [b]             batch, with the files and how to decode them set
+   [nthreads]      number of threads, or 0 for one per CPU
+   [verbose]       prints verbose messages if true
+   returns         number of files that could not be read */
+int decode_batch(batch_t *b, int nthreads, int verbose)
+{
+  pool_t pool;
+  double secs;
+  
+  pool.count = b->count;
+  pool.decode = decode_file;
+  pool.arg = b;
+  nthreads = run_pool(&pool, nthreads, &secs);
+  
+  if (verbose)
+    fprintf(stderr, "*** Decoded %d files in %.3f s on %d thread(s): "
+            "%.1f files/s, %.0f samples/s\n", b->count, secs, nthreads,
+            b->count / secs, pool.samples / secs);
+  
+  return pool.failed;
+}
+
+/********** end batch functions **********/
+
+
+
+
+
+/********** session functions **********/
+
+/* adds the swipe a segmenter has just found to a session
+   [s]             session
+   [sg]            segmenter, with a swipe ready */
+void add_swipe(session_t *s, msr_segment_t *sg)
+{
+  /* grow by doubling */
+  if ((s->count & (s->count - 1)) == 0)
+    s->swipes = xrealloc(s->swipes,
+                         sizeof (swipe_t) * (s->count ? s->count * 2 : 1));
+  s->swipes[s->count].start = sg->msr_sg_start;
+  s->swipes[s->count].end = sg->msr_sg_end;
+  s->count++;
+}
+
+
+/* finds every swipe in a session: each starts where the level goes above
+   the silence threshold on any channel, and ends END_LENGTH msec after it
+   last did, as a single swipe from a device does
+   [s]             session, with the recording set
+   [silence_thres] silence threshold */
+void find_swipes(session_t *s, int silence_thres)
+{
+  msr_segment_t sg;
+  long i, n;
+  
+  msr_segment_init(&sg, silence_thres, s->channels,
+                   (long)s->rate * END_LENGTH / 1000);
+  s->count = 0;
+  s->swipes = NULL;
+  
+  for (i = 0; i < s->size; i += n) {
+    n = msr_segment_push(&sg, s->sample + i * s->channels, s->size - i);
+    if (sg.msr_sg_ready)
+      add_swipe(s, &sg);
+  }
+  
+  /* the recording may stop before the silence after the last swipe does */
+  if (msr_segment_finish(&sg))
+    add_swipe(s, &sg);
+}
+
+
+/* decodes one swipe of a session, every track of it
+   [arg]           session_t the swipe is in
+   [n]             index of the swipe in the session
+   [samples]       increased by the samples read, over all channels
+   [failed]        left alone; a swipe is already in memory
+   returns         when the swipe started and ended, then the bits of each
+                   track, tab separated, or an empty line if no track had
+                   any */
+char *decode_swipe(void *arg, int n, double *samples, int *failed)
+{
+  session_t *s = arg;
+  swipe_t *sw = &s->swipes[n];
+  track_t tracks[MSR_CAPTURE_MAX_CHANNELS];
+  char prefix[64], *line;
+  int size = (int)(sw->end - sw->start), found;
+  
+  /* decode each track in turn; the pool is already busy */
+  found = decode_span(tracks, s->sample + sw->start * s->channels, size,
+                      s->channels, s->rate, &s->params, 0);
+  sprintf(prefix, "%.3f\t%.3f", (double)sw->start / s->rate,
+          (double)sw->end / s->rate);
+  line = span_line(tracks, s->channels, prefix);
+  
+  /* a swipe of nothing but noise gets no line */
+  if (!found)
+    *line = '\0';
+  *samples += (double)size * s->channels;
+  
+  return line;
+}
+
+
+/* decodes the swipes of a session on a pool of threads, printing a line for
+   each swipe with data: when it started and ended, in seconds, then the
+   binary of each track, tab separated
+   [s]             session, with the swipes and how to decode them set
+   [nthreads]      number of threads, or 0 for one per CPU
+   [verbose]       prints verbose messages if true
+   returns         -1 if no data was detected in any swipe, 0 otherwise */
+int decode_session(session_t *s, int nthreads, int verbose)
+{
+  pool_t pool;
+  double secs;
+  
+  pool.count = s->count;
+  pool.decode = decode_swipe;
+  pool.arg = s;
+  nthreads = run_pool(&pool, nthreads, &secs);
+  
+  if (verbose)
+    fprintf(stderr, "*** Decoded %d swipes (%d with no data) in %.3f s on "
+            "%d thread(s): %.1f swipes/s\n", s->count,
+            s->count - pool.printed, secs, nthreads, s->count / secs);
+  
+  return pool.printed > 0 ? 0 : -1;
+}
+
+/********** end session functions **********/
 
 
 
@@ -522,32 +1525,59 @@ void decode_aiken_biphase(int freq_thres, int silence_thres)
 /* main */
 int main(int argc, char *argv[])
 {
-  int fd;
+  int fd = -1, flags = 0;
+  struct stat st;
   SNDFILE *sndfile = NULL;
+  msr_capture_t cap;
+  msr_biphase_t bp;
+  msr_peaks_t peaks;
   
   /* configuration variables */
   char *filename = NULL;
   int auto_thres = AUTO_THRES, max_level = 0, use_sndfile = 0, verbose = 1;
+  int driver = DRIVER_OSS, period = 0, buffer = 0, channels = 1;
   int sample_rate = SAMPLE_RATE, silence_thres = SILENCE_THRES;
+  int adaptive = 0, adapt_thres = AUTO_THRES, pll = 0, interp = 0, bpc = -1;
+  char *timing_name = NULL, *batch_name = NULL;
+  params_t params;
+  batch_t batch;
+  session_t session;
+  int segment = 0;
+  int jobs = 0;
+  int loop = 0, ended = 0, status, thres, thres_hi;
   
   /* getopt variables */
   int ch, option_index;
   static struct option long_options[] = {
     {"auto-thres",   0, 0, 'a'},
+    {"adaptive",     0, 0, 'A'},
+    {"batch",        1, 0, 'b'},
+    {"buffer",       1, 0, 'B'},
+    {"channels",     1, 0, 'c'},
     {"device",       1, 0, 'd'},
+    {"driver",       1, 0, 'D'},
     {"file",         1, 0, 'f'},
     {"help",         0, 0, 'h'},
+    {"interpolate",  0, 0, 'i'},
+    {"jobs",         1, 0, 'j'},
+    {"loop",         0, 0, 'l'},
+    {"pll",          1, 0, 'L'},
     {"max-level",    0, 0, 'm'},
+    {"period",       1, 0, 'P'},
+    {"rate",         1, 0, 'r'},
     {"silent",       0, 0, 's'},
+    {"session",      0, 0, 'S'},
     {"threshold",    1, 0, 't'},
+    {"timing",       1, 0, 'T'},
     {"version",      0, 0, 'v'},
+    {"viterbi",      1, 0, 'V'},
     { 0,             0, 0,  0 }
   };
   
   /* process command line arguments */
   while (1) {
     
-    ch = getopt_long(argc, argv, "a:d:f:hmst:v", long_options, &option_index);
+    ch = getopt_long(argc, argv, "a:Ab:B:c:d:D:f:hij:lL:mP:r:sSt:T:vV:", long_options, &option_index);
     
     if (ch == -1)
       break;
@@ -555,12 +1585,44 @@ int main(int argc, char *argv[])
     switch (ch) {
       /* auto-thres */
       case 'a':
-        auto_thres = atoi(optarg);
+        auto_thres = adapt_thres = atoi(optarg);
+        break;
+      /* adaptive */
+      case 'A':
+        adaptive = 1;
+        break;
+      /* batch */
+      case 'b':
+        batch_name = xstrdup(optarg);
+        break;
+      /* buffer */
+      case 'B':
+        buffer = atoi(optarg);
+        break;
+      /* channels */
+      case 'c':
+        channels = atoi(optarg);
+        if (channels < 1 || channels > MSR_CAPTURE_MAX_CHANNELS) {
+          fprintf(stderr, "*** Error: Channels must be 1 to %d\n",
+                  MSR_CAPTURE_MAX_CHANNELS);
+          exit(EXIT_FAILURE);
+        }
         break;
       /* device */
       case 'd':
         filename = xstrdup(optarg);
         break;
+      /* driver */
+      case 'D':
+        if (!strcmp(optarg, "oss"))
+          driver = DRIVER_OSS;
+        else if (!strcmp(optarg, "alsa"))
+          driver = DRIVER_ALSA;
+        else {
+          fprintf(stderr, "*** Error: Unknown driver %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
       /* file */
       case 'f':
         filename = xstrdup(optarg);
@@ -571,24 +1633,72 @@ int main(int argc, char *argv[])
         print_help(stdout, argv[0]);
         exit(EXIT_SUCCESS);
         break;
+      /* interpolate */
+      case 'i':
+        interp = 1;
+        break;
+      /* jobs */
+      case 'j':
+        jobs = atoi(optarg);
+        break;
+      /* loop */
+      case 'l':
+        loop = 1;
+        break;
+      /* pll */
+      case 'L':
+        pll = atoi(optarg);
+        if (pll < 0 || pll > 100) {
+          fprintf(stderr, "*** Error: PLL bandwidth must be 0 to 100\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
       /* max-level */
       case 'm':
         max_level = 1;
         break;
+      /* period */
+      case 'P':
+        period = atoi(optarg);
+        break;
+      /* rate */
+      case 'r':
+        sample_rate = atoi(optarg);
+        if (sample_rate <= 0) {
+          fprintf(stderr, "*** Error: Invalid sample rate\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
       /* silent */
       case 's':
         verbose = 0;
         break;
+      /* session */
+      case 'S':
+        segment = 1;
+        break;
       /* threshold */
       case 't':
         auto_thres = 0;
         silence_thres = atoi(optarg);
         break;
+      /* timing */
+      case 'T':
+        timing_name = xstrdup(optarg);
+        break;
       /* version */
       case 'v':
         print_version(stdout);
         exit(EXIT_SUCCESS);
         break;
+      /* viterbi */
+      case 'V':
+        bpc = atoi(optarg);
+        if (bpc != 0 && (bpc < 2 || bpc > 8)) {
+          fprintf(stderr, "*** Error: Characters must be 2 to 8 bits, or 0\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
       /* default */
       default:
         print_help(stderr, argv[0]);
@@ -608,29 +1718,91 @@ int main(int argc, char *argv[])
     fprintf(stderr, "*** Error: -f and -m switches do not mix!\n");
     exit(EXIT_FAILURE);
   }
+  if (segment && (!use_sndfile || loop || timing_name != NULL)) {
+    fprintf(stderr, "*** Error: -S needs -f, and does not mix with -l or -T!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bpc >= 0 && (adaptive || timing_name != NULL)) {
+    fprintf(stderr, "*** Error: -V does not mix with -A or -T!\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  /* how to decode the tracks of a sample when decoding it as a whole */
+  params.freq_thres = FREQ_THRES;
+  params.silence_thres = auto_thres && !adaptive ? 0 : silence_thres;
+  params.auto_thres = auto_thres;
+  params.adapt = adaptive ? adapt_thres : 0;
+  params.pll = pll;
+  params.interp = interp;
+  params.bpc = bpc;
+  params.timed = timing_name != NULL;
+  
+  /* decode a batch of files, and nothing else */
+  if (batch_name != NULL) {
+    if (use_sndfile || max_level || timing_name != NULL) {
+      fprintf(stderr, "*** Error: -b does not mix with -f, -m or -T!\n");
+      exit(EXIT_FAILURE);
+    }
+    if (!silence_thres) {
+      fprintf(stderr, "*** Error: Invalid silence threshold\n");
+      exit(EXIT_FAILURE);
+    }
+    
+    memset(&batch, 0, sizeof (batch));
+    batch.names = load_batch(batch_name, &batch.count);
+    batch.params = params;
+    batch.raw_channels = channels;
+    batch.raw_rate = sample_rate;
+    if (verbose)
+      fprintf(stderr, "*** Decoding %d files from %s\n", batch.count,
+              batch_name);
+    
+    status = decode_batch(&batch, jobs, verbose);
+    
+    while (batch.count > 0)
+      free(batch.names[--batch.count]);
+    free(batch.names);
+    free(batch_name);
+    exit(status ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
   
   /* set default if no device is specified */
   if (filename == NULL)
-    filename = xstrdup(DEVICE);
+    filename = xstrdup(driver == DRIVER_ALSA ? ALSA_DEVICE : DEVICE);
   
   /* open device for reading */
   if (verbose)
     fprintf(stderr, "*** Opening %s\n", filename);
-  fd = open(filename, O_RDONLY);
-  if (fd == -1) {
-    perror("open()");
-    exit(EXIT_FAILURE);
+  if (use_sndfile || driver == DRIVER_OSS) {
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+      perror("open()");
+      exit(EXIT_FAILURE);
+    }
   }
   
-  /* open sndfile or set device parameters */
-  if (use_sndfile)
-    sndfile = sndfile_init(fd, verbose);
-  else
-    sample_rate = dsp_init(fd, verbose);
+  /* map or open sndfile, or set device parameters and start capturing */
+  if (use_sndfile) {
+    if (map_file(filename, channels, &sample_rate, verbose) == -1)
+      sndfile = sndfile_init(fd, &sample_rate, verbose);
+  } else if (driver == DRIVER_ALSA)
+    sample_rate = alsa_init(&cap, filename, channels, sample_rate, period,
+                            buffer, verbose);
+  else {
+    sample_rate = dsp_init(fd, channels, sample_rate, verbose);
+    
+    /* a sound card won't wait for us, but a file or pipe will */
+    if (fstat(fd, &st) == 0 && S_ISCHR(st.st_mode))
+      flags = MSR_CAPTURE_DROP;
+    if (msr_capture_start(&cap, fd, channels, 0, 0, flags) == -1) {
+      fprintf(stderr, "*** Error: Could not start audio capture\n");
+      exit(EXIT_FAILURE);
+    }
+  }
   
   /* show user maximum dsp level */
   if (max_level) {
-    print_max_level(fd, sample_rate);
+    print_max_level(&cap, sample_rate);
     exit(EXIT_SUCCESS);
   }
   
@@ -640,32 +1812,141 @@ int main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
   
-  /* read sample */
-  if (use_sndfile)
-    get_sndfile(sndfile);
-  else {
+  /* a file holds a single swipe, with as many tracks as it has channels */
+  if (use_sndfile) {
+    channels = sample_channels;
+    loop = 0;
+  }
+  
+  /* at low sample rates a sample is a good part of a bit */
+  if (sample_rate < INTERP_RATE)
+    interp = 1;
+  if (interp && verbose)
+    fprintf(stderr, "*** Placing peaks between samples\n");
+  
+  /* find every swipe in a long recording, and decode them all at once */
+  if (segment) {
+    if (!sample_mapped)
+      get_sndfile(sndfile);
+    memset(&session, 0, sizeof (session));
+    session.sample = sample_mapped ? sample_map.msr_pm_data : sample;
+    session.size = sample_size;
+    session.channels = sample_channels;
+    session.rate = sample_rate;
+    session.params = params;
+    find_swipes(&session, silence_thres);
     if (verbose)
-      fprintf(stderr, "*** Waiting for sample...\n");
-    get_dsp(fd, sample_rate, silence_thres);
+      fprintf(stderr, "*** Found %d swipes in %.1f s\n", session.count,
+              (double)session.size / sample_rate);
+    
+    status = decode_session(&session, jobs, verbose);
+    
+    free(session.swipes);
+    exit(status ? EXIT_FAILURE : EXIT_SUCCESS);
   }
   
-  /* automatically set threshold */
-  if (auto_thres)
-    silence_thres = auto_thres * evaluate_max() / 100;
+  /* when adapting, silence_thres is only the floor */
+  msr_biphase_init(&bp, silence_thres, FREQ_THRES);
+  if (adaptive)
+    msr_biphase_adapt(&bp, adapt_thres);
+  if (pll)
+    msr_biphase_pll(&bp, pll);
+  msr_biphase_interp(&bp, interp);
+  msr_biphase_times(&bp, bit_times);
+  msr_peaks_init(&peaks);
+  peaks.msr_pk_interp = interp;
+  if (!auto_thres && !adaptive && channels == 1 && verbose)
+    fprintf(stderr, "*** Silence threshold: %d\n", silence_thres);
   
-  /* print silence threshold */
-  if (verbose)
-    fprintf(stderr, "*** Silence threshold: %d (%d%% of max)\n",
-            silence_thres, auto_thres);
+  /* open the timing file */
+  if (timing_name != NULL && (timing = fopen(timing_name, "w")) == NULL) {
+    perror(timing_name);
+    exit(EXIT_FAILURE);
+  }
   
-  /* decode aiken biphase */
-  decode_aiken_biphase(FREQ_THRES, silence_thres);
+  /* decode swipes while the capture thread keeps reading the next one */
+  do {
+    swipe++;
+    if (!use_sndfile && verbose)
+      fprintf(stderr, "*** Waiting for sample...\n");
+    
+    /* with a fixed or adaptive threshold, decode a single track as the
+       sample comes in, unless the whole swipe is wanted at once */
+    if ((!auto_thres || adaptive) && channels == 1 && bpc < 0) {
+      msr_biphase_reset(&bp);
+      if (sample_mapped)
+        stream_map(&bp);
+      else if (use_sndfile)
+        stream_sndfile(sndfile, &bp);
+      else if (stream_dsp(&cap, sample_rate, &bp) == -1)
+        ended = 1;
+      status = ended ? -1 : finish_biphase(&bp);
+      
+      /* print the silence thresholds followed through the swipe */
+      if (adaptive && !ended && verbose) {
+        msr_biphase_levels(&bp, &thres, &thres_hi);
+        fprintf(stderr, "*** Silence threshold: %d to %d (%d%% of level)\n",
+                thres, thres_hi, adapt_thres);
+      }
+    } else {
+      /* read sample, or decode it where it is if mapped */
+      if (sample_mapped)
+        sample = (short int *)sample_map.msr_pm_data;
+      else if (use_sndfile)
+        get_sndfile(sndfile);
+      else if (get_dsp(&cap, sample_rate, silence_thres) == -1)
+        ended = 1;
+      
+      if (ended)
+        status = -1;
+      else if (channels > 1)
+        /* decode every track at once, each with its own threshold */
+        status = decode_tracks(&params, sample_rate, verbose);
+      else {
+        /* automatically set threshold */
+        thres = auto_thres ? auto_thres * evaluate_max() / 100 : silence_thres;
+        
+        /* print silence threshold; a fixed one was printed already */
+        if (verbose && auto_thres)
+          fprintf(stderr, "*** Silence threshold: %d (%d%% of max)\n",
+                  thres, auto_thres);
+        
+        /* decode aiken biphase */
+        status = decode_aiken_biphase(FREQ_THRES, thres, pll, bpc,
+                                      &peaks);
+      }
+    }
+    
+    /* the input has run out between swipes */
+    if (ended && loop)
+      break;
+    
+    if (status == -1) {
+      fprintf(stderr, "*** %s: No data detected\n", loop ? "Warning" : "Error");
+      if (!loop)
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    
+    if (!use_sndfile && verbose)
+      print_capture_stats(&cap);
+  } while (loop);
   
-  /* close file */
-  close(fd);
+  /* stop capturing and close file */
+  if (!use_sndfile)
+    stop_capture(&cap);
+  if (fd != -1)
+    close(fd);
+  
+  if (timing != NULL)
+    fclose(timing);
   
   /* free memory */
-  free(sample);
+  msr_peaks_free(&peaks);
+  if (sample_mapped)
+    msr_pcmmap_close(&sample_map);
+  else
+    free(sample);
   
   exit(EXIT_SUCCESS);
   
@@ -0,0 +1,209 @@
+#include <sys/types.h>
+
+#include <limits.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmsr.h"
+#include "parallel.h"
+
+/*
+ * Track format inference.
+ *
+ * Given a raw track of unknown format, we try every combination of
+ * character width (bpc), starting bit offset and swipe direction,
+ * and score each one by how much the resulting characters look like
+ * a properly encoded track: odd parity on every character, start and
+ * end sentinels, and a matching LRC character after the end sentinel.
+ */
+
+/* Largest number of characters a raw track can be split into. */
+#define MSR_INFER_MAX_CHARS	((MSR_MAX_TRACK_LEN * 8) / MSR_INFER_MIN_BPC + 1)
+
+/* Score weights. Parity is scored in parts per thousand. */
+#define MSR_INFER_SCORE_PARITY	1000
+#define MSR_INFER_SCORE_SS	300
+#define MSR_INFER_SCORE_ES	300
+#define MSR_INFER_SCORE_LRC	400
+
+typedef struct msr_infer_job {
+	msr_track_t *		msr_ij_tracks;
+	msr_hypothesis_t *	msr_ij_hyps;
+} msr_infer_job_t;
+
+static int
+getbit (const uint8_t * buf, int nbits, int bit, int reversed)
+{
+	if (reversed)
+		bit = nbits - 1 - bit;
+	return ((buf[bit >> 3] >> (7 - (bit & 7))) & 1);
+}
+
+/*
+ * Map a candidate number in [0, MSR_INFER_CANDIDATES) to the
+ * bpc/offset/direction triple it stands for.
+ */
+
+static void
+candidate (int n, msr_hypothesis_t * h)
+{
+	memset (h, 0, sizeof(*h));
+	h->msr_hy_reversed = n % 2;
+	n /= 2;
+	h->msr_hy_offset = n % MSR_INFER_OFFSETS;
+	n /= MSR_INFER_OFFSETS;
+	h->msr_hy_bpc = MSR_INFER_MIN_BPC + n;
+}
+
+/*
+ * Score a single hypothesis against a raw track. The bpc, offset and
+ * direction fields of <h> must already be filled in.
+ */
+
+static void
+score (msr_track_t * track, msr_hypothesis_t * h)
+{
+	uint8_t chars[MSR_INFER_MAX_CHARS];
+	msr_charcheck_t cc;
+	int nbits, nchars, bpc, flags;
+	int i, k, pos;
+
+	bpc = h->msr_hy_bpc;
+	nbits = track->msr_tk_len * 8;
+	nchars = (nbits - h->msr_hy_offset) / bpc;
+	if (nchars <= 0)
+		return;
+
+	for (i = 0, pos = h->msr_hy_offset; i < nchars; i++) {
+		chars[i] = 0;
+		for (k = 0; k < bpc; k++, pos++)
+			chars[i] |= getbit (track->msr_tk_data, nbits, pos,
+			    h->msr_hy_reversed) << k;
+	}
+
+	/* Leading and trailing clocking zeros don't count. */
+	flags = msr_check_chars (chars, nchars, bpc, &cc);
+	if (cc.msr_cc_first >= nchars)
+		return;
+
+	h->msr_hy_chars = cc.msr_cc_last - cc.msr_cc_first + 1;
+	h->msr_hy_parity_ok = cc.msr_cc_parity;
+	if (flags & MSR_VALID_SS)
+		h->msr_hy_flags |= MSR_HY_SS;
+	if (flags & MSR_VALID_ES)
+		h->msr_hy_flags |= MSR_HY_ES;
+	if (flags & MSR_VALID_LRC)
+		h->msr_hy_flags |= MSR_HY_LRC;
+
+	h->msr_hy_score = h->msr_hy_parity_ok * MSR_INFER_SCORE_PARITY /
+	    h->msr_hy_chars;
+	if (h->msr_hy_flags & MSR_HY_SS)
+		h->msr_hy_score += MSR_INFER_SCORE_SS;
+	if (h->msr_hy_flags & MSR_HY_ES)
+		h->msr_hy_score += MSR_INFER_SCORE_ES;
+	if (h->msr_hy_flags & MSR_HY_LRC)
+		h->msr_hy_score += MSR_INFER_SCORE_LRC;
+}
+
+/* Rank by score, then by the number of good characters. */
+static int
+rank (const void * a, const void * b)
+{
+	const msr_hypothesis_t * x = a;
+	const msr_hypothesis_t * y = b;
+
+	if (x->msr_hy_score != y->msr_hy_score)
+		return (y->msr_hy_score - x->msr_hy_score);
+	if (x->msr_hy_parity_ok != y->msr_hy_parity_ok)
+		return (y->msr_hy_parity_ok - x->msr_hy_parity_ok);
+	if (x->msr_hy_bpc != y->msr_hy_bpc)
+		return (x->msr_hy_bpc - y->msr_hy_bpc);
+	if (x->msr_hy_offset != y->msr_hy_offset)
+		return (x->msr_hy_offset - y->msr_hy_offset);
+	return (x->msr_hy_reversed - y->msr_hy_reversed);
+}
+
+static void
+score_one (void * arg, int n)
+{
+	msr_infer_job_t * j = arg;
+	msr_hypothesis_t * h = &j->msr_ij_hyps[n];
+
+	candidate (n % MSR_INFER_CANDIDATES, h);
+	score (&j->msr_ij_tracks[n / MSR_INFER_CANDIDATES], h);
+}
+
+static void
+rank_one (void * arg, int n)
+{
+	msr_infer_job_t * j = arg;
+
+	qsort (&j->msr_ij_hyps[n * MSR_INFER_CANDIDATES],
+	    MSR_INFER_CANDIDATES, sizeof(msr_hypothesis_t), rank);
+}
+
+/*
+ * Infer the format of a raw track
+ *
+ * This function scores every bpc, bit offset and direction
+ * combination against the raw track <track> and stores the
+ * results in <hyps>, best first. <hyps> must have room for
+ * MSR_INFER_CANDIDATES entries. The work is done on the calling
+ * thread; use msr_infer_tracks() to triage many tracks at once.
+ *
+ * This function returns the score of the best hypothesis.
+ */
+
+int
+msr_infer_track (msr_track_t * track, msr_hypothesis_t * hyps)
+{
+	int i;
+
+	for (i = 0; i < MSR_INFER_CANDIDATES; i++) {
+		candidate (i, &hyps[i]);
+		score (track, &hyps[i]);
+	}
+	qsort (hyps, MSR_INFER_CANDIDATES, sizeof(msr_hypothesis_t), rank);
+
+	return (hyps[0].msr_hy_score);
+}
+
+/*
+ * Infer the formats of many raw tracks in parallel
+ *
+ * This function is the bulk version of msr_infer_track(). The
+ * <ntracks> tracks in <tracks> are scored against every candidate
+ * format using up to <nthreads> threads (zero means one per CPU).
+ * The ranked hypotheses for track i are stored in <hyps> starting
+ * at index i * MSR_INFER_CANDIDATES, so <hyps> must have room for
+ * <ntracks> * MSR_INFER_CANDIDATES entries.
+ *
+ * This function will fail if any of the arguments are invalid, or
+ * if there are too many tracks for their candidates to be counted
+ * in an int.
+ */
+
+int
+msr_infer_tracks (msr_track_t * tracks, int ntracks,
+    msr_hypothesis_t * hyps, int nthreads)
+{
+	msr_infer_job_t j;
+
+	if (tracks == NULL || hyps == NULL || ntracks < 0 ||
+	    ntracks > INT_MAX / MSR_INFER_CANDIDATES)
+		return (-1);
+
+	j.msr_ij_tracks = tracks;
+	j.msr_ij_hyps = hyps;
+
+	if (msr_parallel_for (ntracks * MSR_INFER_CANDIDATES, nthreads,
+	    score_one, &j) == -1)
+		return (-1);
+	if (msr_parallel_for (ntracks, nthreads, rank_one, &j) == -1)
+		return (-1);
+
+	return (0);
+}
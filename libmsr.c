@@ -4,31 +4,128 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "libmsr.h"
 
+static const char msr_nibble_bits[16][4] = {
+	{ '0', '0', '0', '0' }, { '0', '0', '0', '1' },
+	{ '0', '0', '1', '0' }, { '0', '0', '1', '1' },
+	{ '0', '1', '0', '0' }, { '0', '1', '0', '1' },
+	{ '0', '1', '1', '0' }, { '0', '1', '1', '1' },
+	{ '1', '0', '0', '0' }, { '1', '0', '0', '1' },
+	{ '1', '0', '1', '0' }, { '1', '0', '1', '1' },
+	{ '1', '1', '0', '0' }, { '1', '1', '0', '1' },
+	{ '1', '1', '1', '0' }, { '1', '1', '1', '1' }
+};
+
+static const char msr_hex_digits[16] = "0123456789abcdef";
+
+/*
+ * Render <len> bytes of <buf> as a string of '0' and '1' characters
+ * into <out>, which is <outlen> bytes long. As with msr_dumpbits(),
+ * each byte is shown from its most significant bit down, which is
+ * the order the bits come off the card. <out> needs room for
+ * MSR_FORMAT_BITS_LEN(len) bytes.
+ *
+ * Returns the length of the string, not counting the terminating
+ * NUL, or -1 if <out> is too small.
+ */
+
 int
-msr_dumpbits (uint8_t * buf, int len)
+msr_format_bits (const uint8_t * buf, int len, char * out, size_t outlen)
 {
-	int		bytes, i;
+	char * p = out;
+	int i;
 
-	for (bytes = 0; bytes < len; bytes++) {
+	if (len < 0 || outlen < MSR_FORMAT_BITS_LEN(len))
+		return (-1);
 
-		/*
-		 * Note: we want to display the bits in the order in
-		 * which they're read off the card, which means we
-		 * have to decode each byte from most significant bit
-		 * to least significant bit.
-		 */
+	for (i = 0; i < len; i++) {
+		memcpy (p, msr_nibble_bits[buf[i] >> 4], 4);
+		memcpy (p + 4, msr_nibble_bits[buf[i] & 0xf], 4);
+		p += 8;
+	}
+	*p = '\0';
 
-		for (i = 7; i > -1; i--) {
-			if (buf[bytes] & (1 << i))
-				printf("1");
-			else
-				printf("0");
-		}
+	return (p - out);
+}
+
+/*
+ * Render <len> bytes of <buf> into <out> as space separated hex
+ * bytes, the way msr_pretty_printer_hex() shows them. <out> needs
+ * room for MSR_FORMAT_HEX_LEN(len) bytes.
+ *
+ * Returns the length of the string, not counting the terminating
+ * NUL, or -1 if <out> is too small.
+ */
+
+int
+msr_format_hex (const uint8_t * buf, int len, char * out, size_t outlen)
+{
+	char * p = out;
+	int i;
+
+	if (len < 0 || outlen < MSR_FORMAT_HEX_LEN(len))
+		return (-1);
+
+	for (i = 0; i < len; i++) {
+		p[0] = msr_hex_digits[buf[i] >> 4];
+		p[1] = msr_hex_digits[buf[i] & 0xf];
+		p[2] = ' ';
+		p += 3;
 	}
-	printf ("\n");
+	*p = '\0';
+
+	return (p - out);
+}
+
+/*
+ * Render <len> bytes of <buf> into <out> as ASCII, with anything
+ * unprintable shown as a '.'. <out> needs room for
+ * MSR_FORMAT_ASCII_LEN(len) bytes.
+ *
+ * Returns the length of the string, not counting the terminating
+ * NUL, or -1 if <out> is too small.
+ */
+
+int
+msr_format_ascii (const uint8_t * buf, int len, char * out, size_t outlen)
+{
+	int i;
+
+	if (len < 0 || outlen < MSR_FORMAT_ASCII_LEN(len))
+		return (-1);
+
+	for (i = 0; i < len; i++)
+		out[i] = (buf[i] >= 0x20 && buf[i] < 0x7f) ? buf[i] : '.';
+	out[i] = '\0';
+
+	return (i);
+}
+
+int
+msr_dumpbits (uint8_t * buf, int len)
+{
+	char line[MSR_FORMAT_BITS_LEN(MSR_MAX_TRACK_LEN)];
+	int bytes, n;
+
+	/*
+	 * Note: we want to display the bits in the order in
+	 * which they're read off the card, which means we
+	 * have to decode each byte from most significant bit
+	 * to least significant bit. msr_format_bits() does
+	 * that for us, a track's worth at a time.
+	 */
+
+	for (bytes = 0; bytes < len; bytes += n) {
+		n = len - bytes;
+		if (n > MSR_MAX_TRACK_LEN)
+			n = MSR_MAX_TRACK_LEN;
+		msr_format_bits (buf + bytes, n, line, sizeof(line));
+		fputs (line, stdout);
+	}
+	putchar ('\n');
 	return (0);
 }
 
@@ -74,6 +171,125 @@ msr_setbit (uint8_t * buf, uint8_t len, int bit, int val)
 }
 
 
+/*
+ * Bit reversal table. Raw track bytes hold their first bit in the
+ * most significant position, while characters are built least
+ * significant bit first, so reversing each byte as it is loaded
+ * lets the kernels below peel characters off the bottom of an
+ * accumulator.
+ */
+
+#define R2(n)	n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n)	R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n)	R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+
+static const uint8_t msr_rev_table[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+/*
+ * Character set mappings between the data bits of a character and
+ * ASCII, one pair per kernel. These have to agree with the generic
+ * msr_decode() loop. The 8 bit decode mapping folds two ranges of
+ * data values onto the same characters, so its encode mapping picks
+ * the lower one.
+ */
+
+#define MSR_MAP5_DECODE(d)	((d) | 0x30)
+#define MSR_MAP5_ENCODE(c)	((c) - 0x30)
+#define MSR_MAP7_DECODE(d)	((d) + 0x20)
+#define MSR_MAP7_ENCODE(c)	((c) - 0x20)
+#define MSR_MAP8_DECODE(d)	((d) < 0x20 ? (d) | 0x20 : ((d) | 0x40) - 0x20)
+#define MSR_MAP8_ENCODE(c)	((c) - 0x20)
+
+/*
+ * Decode kernel for a fixed character width. The character count is
+ * worked out up front, so the loop needs no bounds checks of its own.
+ * Same return conventions as msr_decode().
+ */
+
+#define MSR_DECODE_KERNEL(name, bpc, map)				\
+static int								\
+name (const uint8_t * in, int inlen, uint8_t * out, uint8_t * outlen)	\
+{									\
+	uint32_t acc = 0;						\
+	int nacc = 0, n, x, d;						\
+									\
+	n = inlen * 8 / (bpc);						\
+	if (n > *outlen)						\
+		n = *outlen;						\
+									\
+	for (x = 0; x < n; x++) {					\
+		if (nacc < (bpc)) {					\
+			acc |= (uint32_t)msr_rev_table[*in++] << nacc;	\
+			nacc += 8;					\
+		}							\
+		d = acc & ((1 << ((bpc) - 1)) - 1);			\
+		out[x] = map(d);					\
+		acc >>= (bpc);						\
+		nacc -= (bpc);						\
+	}								\
+									\
+	if (n == *outlen)						\
+		return (-1);						\
+	*outlen = n;							\
+	return (0);							\
+}
+
+/*
+ * Encode kernel for a fixed character width: the reverse of the
+ * decode kernel, with an odd parity bit added to every character.
+ * The last byte is padded with zero bits.
+ */
+
+#define MSR_ENCODE_KERNEL(name, bpc, map)				\
+static int								\
+name (const uint8_t * in, int inlen, uint8_t * out, uint8_t * outlen)	\
+{									\
+	uint32_t acc = 0;						\
+	int nacc = 0, o = 0, x, d;					\
+									\
+	if ((inlen * (bpc) + 7) / 8 > *outlen)				\
+		return (-1);						\
+									\
+	for (x = 0; x < inlen; x++) {					\
+		d = map(in[x]) & ((1 << ((bpc) - 1)) - 1);		\
+		d |= !msr_parity (d) << ((bpc) - 1);			\
+		acc |= (uint32_t)d << nacc;				\
+		nacc += (bpc);						\
+		if (nacc >= 8) {					\
+			out[o++] = msr_rev_table[acc & 0xff];		\
+			acc >>= 8;					\
+			nacc -= 8;					\
+		}							\
+	}								\
+	if (nacc)							\
+		out[o++] = msr_rev_table[acc & 0xff];			\
+									\
+	*outlen = o;							\
+	return (0);							\
+}
+
+MSR_DECODE_KERNEL(decode5, 5, MSR_MAP5_DECODE)
+MSR_DECODE_KERNEL(decode7, 7, MSR_MAP7_DECODE)
+MSR_DECODE_KERNEL(decode8, 8, MSR_MAP8_DECODE)
+
+MSR_ENCODE_KERNEL(encode5, 5, MSR_MAP5_ENCODE)
+MSR_ENCODE_KERNEL(encode7, 7, MSR_MAP7_ENCODE)
+MSR_ENCODE_KERNEL(encode8, 8, MSR_MAP8_ENCODE)
+
+/*
+ * Decode raw track bits into characters
+ *
+ * This function splits the <inlen> bytes of raw track data in
+ * <inbuf> into characters of <bpc> bits, strips the parity bit and
+ * maps each one to ASCII, storing at most <outlen> characters in
+ * <outbuf>. The common widths of 5, 7 and 8 bits are handed to
+ * kernels specialized for them; anything else goes through the
+ * generic loop.
+ *
+ * On success <outlen> is set to the number of characters decoded.
+ * This function will fail if <outbuf> fills up.
+ */
+
 int
 msr_decode(uint8_t * inbuf, uint8_t inlen,
     uint8_t * outbuf, uint8_t * outlen, int bpc)
@@ -84,6 +300,15 @@ msr_decode(uint8_t * inbuf, uint8_t inlen,
 	char byte = 0;
 	int i, x;
 
+	switch (bpc) {
+	case 5:
+		return (decode5 (inbuf, inlen, outbuf, outlen));
+	case 7:
+		return (decode7 (inbuf, inlen, outbuf, outlen));
+	case 8:
+		return (decode8 (inbuf, inlen, outbuf, outlen));
+	}
+
 	len = inlen;
 	b = inbuf;
 	x = 0;
@@ -130,6 +355,325 @@ msr_decode(uint8_t * inbuf, uint8_t inlen,
 	return (0);
 }
 
+/*
+ * Encode characters into raw track bits
+ *
+ * This function is the reverse of msr_decode(): each of the <inlen>
+ * ASCII characters in <inbuf> is mapped to <bpc> - 1 data bits, an
+ * odd parity bit is added, and the characters are packed into
+ * <outbuf> in the order they are recorded on the card. Sentinels
+ * and the LRC are not added; pass them in as characters.
+ *
+ * On success <outlen> is set to the number of bytes written. This
+ * function will fail if <outbuf> is too small or <bpc> is not
+ * between 5 and 8.
+ */
+
+int
+msr_encode (uint8_t * inbuf, uint8_t inlen,
+    uint8_t * outbuf, uint8_t * outlen, int bpc)
+{
+	int x, k, bit, d;
+
+	switch (bpc) {
+	case 5:
+		return (encode5 (inbuf, inlen, outbuf, outlen));
+	case 7:
+		return (encode7 (inbuf, inlen, outbuf, outlen));
+	case 8:
+		return (encode8 (inbuf, inlen, outbuf, outlen));
+	case 6:
+		break;
+	default:
+		return (-1);
+	}
+
+	if ((inlen * bpc + 7) / 8 > *outlen)
+		return (-1);
+
+	memset (outbuf, 0, (inlen * bpc + 7) / 8);
+	for (x = 0, bit = 0; x < inlen; x++) {
+		d = msr_addparity (inbuf[x] & 0x0f, bpc);
+		for (k = 0; k < bpc; k++, bit++)
+			msr_setbit (outbuf, *outlen, bit, (d >> k) & 1);
+	}
+	*outlen = (inlen * bpc + 7) / 8;
+
+	return (0);
+}
+
+/*
+ * Check framed characters
+ *
+ * This function checks the <nchars> characters of <bpc> bits in
+ * <chars>, one to a byte with the parity bit on top, however they
+ * were framed. Leading and trailing all-zero characters are clocking
+ * bits and are skipped. For the ISO widths the start and end
+ * sentinels are looked for and the LRC character following the end
+ * sentinel is checked; for other widths the last character is taken
+ * to be the LRC, and the one before it stands in for the end
+ * sentinel. What was found is stored in <cc>, if it is not NULL.
+ *
+ * Returns a mask of MSR_VALID_* flags for the checks that passed;
+ * none pass if every character is zero.
+ */
+
+int
+msr_check_chars (const uint8_t * chars, int nchars, int bpc,
+    msr_charcheck_t * cc)
+{
+	msr_charcheck_t c;
+	int ss_c, es_c, lrc, mask, i;
+
+	memset (&c, 0, sizeof (c));
+	c.msr_cc_es = -1;
+
+	for (c.msr_cc_first = 0; c.msr_cc_first < nchars &&
+	    chars[c.msr_cc_first] == 0; c.msr_cc_first++)
+		;
+	for (c.msr_cc_last = nchars - 1; c.msr_cc_last > c.msr_cc_first &&
+	    chars[c.msr_cc_last] == 0; c.msr_cc_last--)
+		;
+	if (c.msr_cc_first >= nchars) {
+		if (cc != NULL)
+			*cc = c;
+		return (0);
+	}
+
+	for (i = c.msr_cc_first; i <= c.msr_cc_last; i++)
+		c.msr_cc_parity += msr_parity (chars[i]);
+	if (c.msr_cc_parity == c.msr_cc_last - c.msr_cc_first + 1)
+		c.msr_cc_flags |= MSR_VALID_PARITY;
+
+	/* Only the ISO widths have sentinels we can look for. */
+	if (bpc == MSR_ABA_BPC || bpc == MSR_IATA_BPC) {
+		ss_c = msr_addparity (bpc == MSR_ABA_BPC ?
+		    MSR_ABA_SS : MSR_IATA_SS, bpc);
+		es_c = msr_addparity (bpc == MSR_ABA_BPC ?
+		    MSR_ABA_ES : MSR_IATA_ES, bpc);
+		if (chars[c.msr_cc_first] == ss_c)
+			c.msr_cc_flags |= MSR_VALID_SS;
+		for (i = c.msr_cc_first + 1; i <= c.msr_cc_last; i++) {
+			if (chars[i] == es_c) {
+				c.msr_cc_flags |= MSR_VALID_ES;
+				c.msr_cc_es = i;
+				break;
+			}
+		}
+	} else if (c.msr_cc_last > c.msr_cc_first)
+		c.msr_cc_es = c.msr_cc_last - 1;
+
+	/* The LRC covers everything up to and including the end sentinel. */
+	mask = (1 << (bpc - 1)) - 1;
+	if (c.msr_cc_es >= c.msr_cc_first && c.msr_cc_es < c.msr_cc_last) {
+		for (lrc = 0, i = c.msr_cc_first; i <= c.msr_cc_es; i++)
+			lrc ^= chars[i] & mask;
+		if (chars[c.msr_cc_es + 1] == msr_addparity (lrc, bpc))
+			c.msr_cc_flags |= MSR_VALID_LRC;
+	}
+
+	if (cc != NULL)
+		*cc = c;
+
+	return (c.msr_cc_flags);
+}
+
+/*
+ * Check the integrity of raw track data
+ *
+ * This function splits the <len> bytes of raw track data in <buf>
+ * into characters of <bpc> bits, framed from the first bit just as
+ * msr_decode() does, and checks them with msr_check_chars().
+ *
+ * Returns a mask of MSR_VALID_* flags for the checks that passed.
+ */
+
+int
+msr_validate (const uint8_t * buf, int len, int bpc)
+{
+	uint8_t chars[MSR_MAX_TRACK_BITS / 5];
+	uint32_t acc = 0;
+	int nacc = 0, nchars, i;
+
+	if (bpc < 5 || bpc > 8)
+		return (0);
+	if (len > MSR_MAX_TRACK_LEN)
+		len = MSR_MAX_TRACK_LEN;
+
+	nchars = len * 8 / bpc;
+	for (i = 0; i < nchars; i++) {
+		if (nacc < bpc) {
+			acc |= (uint32_t)msr_rev_table[*buf++] << nacc;
+			nacc += 8;
+		}
+		chars[i] = acc & ((1 << bpc) - 1);
+		acc >>= bpc;
+		nacc -= bpc;
+	}
+
+	return (msr_check_chars (chars, nchars, bpc, NULL));
+}
+
+static int
+rawchar (const uint8_t * buf, int pos, int bpc)
+{
+	int c, k;
+
+	for (c = 0, k = 0; k < bpc; k++, pos++)
+		c |= ((buf[pos >> 3] >> (7 - (pos & 7))) & 1) << k;
+
+	return (c);
+}
+
+/*
+ * Repair a single bit error in an ISO formatted raw track
+ *
+ * A flipped bit in a data character shows up twice: the character
+ * fails its parity check, and the LRC disagrees in the column the
+ * bit sits in. When exactly one character between the sentinels
+ * fails parity and the LRC is off in exactly one column, the bad
+ * bit is the one where they cross. If the LRC agrees instead, the
+ * character's parity bit itself was flipped. Single bit errors in
+ * the end sentinel and in the LRC character are found the same way.
+ *
+ * The track in <buf>, <len> bytes long, is framed from its first bit
+ * just as msr_decode() and msr_validate() do, so whatever is repaired
+ * here decodes the same way afterwards, and <bpc> must be one of the
+ * ISO widths. Leading all-zero characters are clocking bits. If <fix>
+ * is not NULL, it is filled in with the position of the flipped bit,
+ * or with -1s if no bit was flipped.
+ *
+ * Returns 0 if the track was already good, 1 if one bit was
+ * corrected in place, or -1 if the track can't be repaired.
+ */
+
+int
+msr_correct (uint8_t * buf, int len, int bpc, msr_correction_t * fix)
+{
+	uint8_t chars[MSR_MAX_TRACK_BITS / 5];
+	int first, nchars, es_c, es, bad, lrc, col, mask;
+	int i, pos;
+
+	if (fix != NULL) {
+		fix->msr_cr_bit = -1;
+		fix->msr_cr_char = -1;
+		fix->msr_cr_column = -1;
+	}
+
+	if (bpc != MSR_ABA_BPC && bpc != MSR_IATA_BPC)
+		return (-1);
+	if (len > MSR_MAX_TRACK_LEN)
+		len = MSR_MAX_TRACK_LEN;
+
+	nchars = len * 8 / bpc;
+	for (i = 0; i < nchars; i++)
+		chars[i] = rawchar (buf, i * bpc, bpc);
+	for (first = 0; first < nchars && chars[first] == 0; first++)
+		;
+	if (nchars - first < 3)
+		return (-1);
+
+	mask = (1 << (bpc - 1)) - 1;
+	es_c = msr_addparity (bpc == MSR_ABA_BPC ? MSR_ABA_ES : MSR_IATA_ES,
+	    bpc);
+
+	/*
+	 * Walk to the end sentinel, noting the character with bad parity.
+	 * If that character is one bit away from the end sentinel, it may
+	 * be the end sentinel itself; if no good end sentinel turns up
+	 * before the next bad character, we take it to be.
+	 */
+
+	bad = -1;
+	for (es = first; es < nchars - 1; es++) {
+		if (es > first && chars[es] == es_c)
+			break;
+		if (msr_parity (chars[es]))
+			continue;
+		if (bad != -1)
+			break;
+		bad = es;
+	}
+	if (es == nchars - 1 || chars[es] != es_c) {
+		if (bad <= first ||
+		    ((chars[bad] ^ es_c) & ((chars[bad] ^ es_c) - 1)))
+			return (-1);
+		es = bad;
+	}
+
+	for (lrc = 0, i = first; i <= es; i++)
+		lrc ^= (i == es ? es_c : chars[i]) & mask;
+	col = (chars[es + 1] ^ lrc) & mask;
+
+	if (bad == es) {
+		/* The end sentinel itself took the hit; the LRC must agree. */
+		if (col != 0 || !msr_parity (chars[es + 1]))
+			return (-1);
+		col = chars[es] ^ es_c;
+		for (i = 0; !(col & (1 << i)); i++)
+			;
+		pos = es * bpc + i;
+	} else if (bad == -1 && col == 0) {
+		if (msr_parity (chars[es + 1]))
+			return (0);
+		/* Only the LRC's own parity bit is wrong. */
+		pos = (es + 1) * bpc + bpc - 1;
+	} else if (bad == -1 && !(col & (col - 1))) {
+		/* A data bit of the LRC itself, which then fails parity. */
+		if (msr_parity (chars[es + 1]))
+			return (-1);
+		for (i = 0; !(col & (1 << i)); i++)
+			;
+		pos = (es + 1) * bpc + i;
+	} else if (msr_parity (chars[es + 1]) && col == 0)
+		/* The bad character's parity bit. */
+		pos = bad * bpc + bpc - 1;
+	else if (msr_parity (chars[es + 1]) && !(col & (col - 1))) {
+		for (i = 0; !(col & (1 << i)); i++)
+			;
+		pos = bad * bpc + i;
+	} else
+		return (-1);
+
+	buf[pos >> 3] ^= 0x80 >> (pos & 7);
+
+	if (fix != NULL) {
+		fix->msr_cr_bit = pos;
+		fix->msr_cr_char = pos / bpc - first;
+		fix->msr_cr_column = pos % bpc;
+	}
+
+	return (1);
+}
+
+/*
+ * Decode raw track bits, repairing a single bit error first
+ *
+ * This function is msr_decode() with msr_correct() run over a copy
+ * of the track beforehand, for worn cards where a re-swipe costs
+ * more than the extra work. <inbuf> itself is not changed. If
+ * <fix> is not NULL, its msr_cr_status field is set to the
+ * msr_correct() result and the rest to the bit that was corrected,
+ * or to -1s if none was.
+ *
+ * This function will fail if the track can't be decoded.
+ */
+
+int
+msr_decode_ecc (uint8_t * inbuf, uint8_t inlen,
+    uint8_t * outbuf, uint8_t * outlen, int bpc, msr_correction_t * fix)
+{
+	uint8_t buf[MSR_MAX_TRACK_LEN];
+	int r;
+
+	memcpy (buf, inbuf, inlen);
+	r = msr_correct (buf, inlen, bpc, fix);
+	if (fix != NULL)
+		fix->msr_cr_status = r;
+
+	return (msr_decode (buf, inlen, outbuf, outlen, bpc));
+}
+
 /* Some cards require a swipe in the opposite direction of the reader. */
 /* We can get the expected bit stream by reversing the data in place. */
 int
@@ -181,26 +725,99 @@ msr_reverse_track (int track_number, msr_tracks_t * tracks)
 void
 msr_pretty_printer_hex (msr_tracks_t tracks)
 {
-	int track_number;
-	for (track_number = 0; track_number < MSR_MAX_TRACKS; track_number++) {
-		int x;
-		printf("Track %d: \n", track_number);
-		for (x = 0; x < tracks.msr_tracks[track_number].msr_tk_len; x++)
-			printf("%02x ", tracks.msr_tracks[track_number].msr_tk_data[x]);
-		printf("\n");
-	}
+	msr_print_hex (stdout, &tracks);
 }
 
 /* Take a track structure and print it as a string. */
 void
 msr_pretty_printer_string (msr_tracks_t tracks)
 {
+	msr_print_string (stdout, &tracks);
+}
+
+/*
+ * Print every track in <tracks> on <fp> as hex bytes. The whole
+ * dump is formatted into one buffer and written out at once.
+ */
+
+void
+msr_print_hex (FILE * fp, const msr_tracks_t * tracks)
+{
+	char buf[MSR_MAX_TRACKS * (MSR_FORMAT_HEX_LEN(MSR_MAX_TRACK_LEN) + 16)];
+	char * p = buf;
 	int track_number;
+
 	for (track_number = 0; track_number < MSR_MAX_TRACKS; track_number++) {
-		if (tracks.msr_tracks[track_number].msr_tk_len)
-			printf ("Track %d: \n[%s]\n", track_number,
-			tracks.msr_tracks[track_number].msr_tk_data);
+		memcpy (p, "Track ", 6);
+		p[6] = '0' + track_number;
+		memcpy (p + 7, ": \n", 3);
+		p += 10;
+		p += msr_format_hex (tracks->msr_tracks[track_number].msr_tk_data,
+		    tracks->msr_tracks[track_number].msr_tk_len,
+		    p, MSR_FORMAT_HEX_LEN(MSR_MAX_TRACK_LEN));
+		*p++ = '\n';
 	}
+
+	fwrite (buf, 1, p - buf, fp);
+}
+
+/*
+ * Print every non-empty track in <tracks> on <fp> as a string,
+ * stopping at the track length or the first NUL, whichever comes
+ * first.
+ */
+
+void
+msr_print_string (FILE * fp, const msr_tracks_t * tracks)
+{
+	char buf[MSR_MAX_TRACKS * (MSR_MAX_TRACK_LEN + 16)];
+	char * p = buf;
+	const msr_track_t * t;
+	const uint8_t * nul;
+	int track_number, len;
+
+	for (track_number = 0; track_number < MSR_MAX_TRACKS; track_number++) {
+		t = &tracks->msr_tracks[track_number];
+		if (!t->msr_tk_len)
+			continue;
+		len = t->msr_tk_len;
+		nul = memchr (t->msr_tk_data, '\0', len);
+		if (nul != NULL)
+			len = nul - t->msr_tk_data;
+
+		memcpy (p, "Track ", 6);
+		p[6] = '0' + track_number;
+		memcpy (p + 7, ": \n[", 4);
+		p += 11;
+		memcpy (p, t->msr_tk_data, len);
+		p += len;
+		memcpy (p, "]\n", 2);
+		p += 2;
+	}
+
+	fwrite (buf, 1, p - buf, fp);
+}
+
+/* Return the parity of <c>: 1 if it has an odd number of bits set. */
+int
+msr_parity (uint32_t c)
+{
+	c ^= c >> 16;
+	c ^= c >> 8;
+	c ^= c >> 4;
+	c ^= c >> 2;
+	c ^= c >> 1;
+	return (c & 1);
+}
+
+/* Return the <bpc> bit character for <data> with its odd parity bit set. */
+int
+msr_addparity (int data, int bpc)
+{
+	int mask = (1 << (bpc - 1)) - 1;
+
+	data &= mask;
+	return (data | (!msr_parity (data) << (bpc - 1)));
 }
 
 /* Reverse a byte. */
@@ -1,6 +1,7 @@
 /* Everyone must include libmsr.h or they're doing it wrong! */
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdio.h>
 
 /*
  * Track lengths when doing raw accesses can be at most 256 byte
@@ -10,6 +11,7 @@
 
 #define MSR_MAX_TRACK_LEN 255
 #define MSR_MAX_TRACKS 3
+#define MSR_MAX_TRACK_BITS (MSR_MAX_TRACK_LEN * 8)
 #define MSR_BLOCKING O_NONBLOCK
 #define MSR_BAUD B9600
 
@@ -22,6 +24,144 @@ typedef struct msr_tracks {
 	msr_track_t	msr_tracks[MSR_MAX_TRACKS];
 } msr_tracks_t;
 
+/*
+ * A growable track or sample buffer with a 32 bit length, for data
+ * that won't fit in an msr_track_t. Up to MSR_TKBUF_INLINE bytes live
+ * inside the structure; anything longer moves to the heap. A buffer
+ * may also borrow the storage of an msr_track_t. Use the msr_tkbuf_*()
+ * routines rather than poking at the fields.
+ */
+
+#define MSR_TKBUF_INLINE	(MSR_MAX_TRACK_LEN + 1)
+
+#define MSR_TKBUF_WHERE_INLINE	0	/* Data in msr_tb_inline */
+#define MSR_TKBUF_WHERE_HEAP	1	/* Data in msr_tb_heap */
+#define MSR_TKBUF_WHERE_TRACK	2	/* Data in msr_tb_track */
+
+typedef struct msr_tkbuf {
+	int		msr_tb_where;
+	uint32_t	msr_tb_len;
+	uint8_t *	msr_tb_heap;
+	uint32_t	msr_tb_heap_size;
+	msr_track_t *	msr_tb_track;
+	uint8_t		msr_tb_inline[MSR_TKBUF_INLINE];
+} msr_tkbuf_t;
+
+typedef struct msr_tkbufs {
+	msr_tkbuf_t	msr_tkbufs[MSR_MAX_TRACKS];
+} msr_tkbufs_t;
+
+/*
+ * Buffer sizes needed by the msr_format_*() routines to render
+ * <len> bytes of track data, including the terminating NUL.
+ */
+
+#define MSR_FORMAT_BITS_LEN(len)	((size_t)(len) * 8 + 1)
+#define MSR_FORMAT_HEX_LEN(len)		((size_t)(len) * 3 + 1)
+#define MSR_FORMAT_ASCII_LEN(len)	((size_t)(len) + 1)
+
+/*
+ * ISO 7811 character sets. Characters are recorded least significant
+ * bit first and end with an odd parity bit. The sentinel values below
+ * are the data bits only, without the parity bit.
+ */
+
+#define MSR_ABA_BPC	5	/* Tracks 2 and 3 */
+#define MSR_ABA_SS	0x0B	/* ';' */
+#define MSR_ABA_ES	0x0F	/* '?' */
+#define MSR_IATA_BPC	7	/* Track 1 */
+#define MSR_IATA_SS	0x05	/* '%' */
+#define MSR_IATA_ES	0x1F	/* '?' */
+
+/* Results of msr_validate(). */
+
+#define MSR_VALID_PARITY	0x01	/* Every character passes parity */
+#define MSR_VALID_SS		0x02	/* Start sentinel found */
+#define MSR_VALID_ES		0x04	/* End sentinel found */
+#define MSR_VALID_LRC		0x08	/* LRC character matches */
+
+/* What msr_check_chars() found in a track's characters. */
+
+typedef struct msr_charcheck {
+	int		msr_cc_flags;	/* MSR_VALID_* */
+	int		msr_cc_first;	/* First character past the clocking */
+	int		msr_cc_last;	/* Last one before the clocking */
+	int		msr_cc_parity;	/* Characters between them passing parity */
+	int		msr_cc_es;	/* End sentinel, or -1 */
+} msr_charcheck_t;
+
+/* A bit repaired by msr_correct(). */
+
+typedef struct msr_correction {
+	int		msr_cr_status;	/* msr_correct() result */
+	int		msr_cr_bit;	/* Bit position in the raw track */
+	int		msr_cr_char;	/* Character, counting the start sentinel */
+	int		msr_cr_column;	/* Bit within that character */
+} msr_correction_t;
+
+/*
+ * Batches of raw tracks for msr_batch_decode(), stored as separate
+ * arrays: one of lengths, and one of payloads laid end to end at a
+ * fixed stride. Track i starts at msr_bt_data + i * msr_bt_stride.
+ * The output side uses the same layout for the decoded characters,
+ * plus a status word per track.
+ */
+
+#define MSR_BATCH_REVERSE	0x01	/* Reverse each track before decoding */
+
+#define MSR_BATCH_DECODED	0x100	/* msr_decode() succeeded */
+
+typedef struct msr_batch {
+	int		msr_bt_count;
+	int		msr_bt_stride;
+	uint8_t *	msr_bt_lens;
+	uint8_t *	msr_bt_data;
+} msr_batch_t;
+
+typedef struct msr_batch_out {
+	int		msr_bo_stride;
+	uint8_t *	msr_bo_lens;
+	uint8_t *	msr_bo_data;
+	uint16_t *	msr_bo_status;	/* MSR_VALID_* | MSR_BATCH_DECODED */
+} msr_batch_out_t;
+
+typedef struct msr_batch_stats {
+	int		msr_bs_tracks;
+	int		msr_bs_threads;
+	double		msr_bs_seconds;
+	double		msr_bs_tracks_per_sec;
+} msr_batch_stats_t;
+
+/*
+ * A guess at the format of a raw track, as produced by
+ * msr_infer_track(). Candidates cover every bpc from
+ * MSR_INFER_MIN_BPC to MSR_INFER_MAX_BPC, every starting bit
+ * offset below MSR_INFER_OFFSETS and both swipe directions.
+ */
+
+#define MSR_INFER_MIN_BPC	5
+#define MSR_INFER_MAX_BPC	8
+#define MSR_INFER_OFFSETS	8
+#define MSR_INFER_CANDIDATES	\
+	((MSR_INFER_MAX_BPC - MSR_INFER_MIN_BPC + 1) * MSR_INFER_OFFSETS * 2)
+
+#define MSR_HY_SS	0x01	/* Start sentinel found */
+#define MSR_HY_ES	0x02	/* End sentinel found */
+#define MSR_HY_LRC	0x04	/* LRC character matches */
+
+typedef struct msr_hypothesis {
+	uint8_t		msr_hy_bpc;
+	uint8_t		msr_hy_offset;
+	uint8_t		msr_hy_reversed;
+	uint8_t		msr_hy_flags;
+	int		msr_hy_chars;		/* Characters examined */
+	int		msr_hy_parity_ok;	/* Characters with good parity */
+	int		msr_hy_score;
+} msr_hypothesis_t;
+
+/* Most swipes msr_consensus_track() will vote over. */
+#define MSR_MAX_SWIPES	32
+
 extern int msr_zeros (int);
 extern int msr_commtest (int);
 extern int msr_init (int);
@@ -44,11 +184,49 @@ extern int msr_dumpbits (uint8_t *, int);
 extern int msr_getbit (uint8_t *, uint8_t, int);
 extern int msr_setbit (uint8_t *, uint8_t, int, int);
 extern int msr_decode (uint8_t *, uint8_t, uint8_t *, uint8_t *, int);
+extern int msr_encode (uint8_t *, uint8_t, uint8_t *, uint8_t *, int);
+extern int msr_check_chars (const uint8_t *, int, int, msr_charcheck_t *);
+extern int msr_validate (const uint8_t *, int, int);
+extern int msr_correct (uint8_t *, int, int, msr_correction_t *);
+extern int msr_decode_ecc (uint8_t *, uint8_t, uint8_t *, uint8_t *, int,
+    msr_correction_t *);
+extern int msr_batch_decode (const msr_batch_t *, int, int, msr_batch_out_t *,
+    int, msr_batch_stats_t *);
 
 extern int msr_reverse_tracks (msr_tracks_t *);
 extern int msr_reverse_track (int, msr_tracks_t *);
 
+extern int msr_format_bits (const uint8_t *, int, char *, size_t);
+extern int msr_format_hex (const uint8_t *, int, char *, size_t);
+extern int msr_format_ascii (const uint8_t *, int, char *, size_t);
+
 extern void msr_pretty_printer_hex (msr_tracks_t tracks);
 extern void msr_pretty_printer_string (msr_tracks_t tracks);
+extern void msr_print_hex (FILE *, const msr_tracks_t *);
+extern void msr_print_string (FILE *, const msr_tracks_t *);
 
 extern const unsigned char msr_reverse_byte (const unsigned char);
+extern int msr_parity (uint32_t);
+extern int msr_addparity (int, int);
+
+extern int msr_infer_track (msr_track_t *, msr_hypothesis_t *);
+extern int msr_infer_tracks (msr_track_t *, int, msr_hypothesis_t *, int);
+
+extern void msr_tkbuf_init (msr_tkbuf_t *);
+extern void msr_tkbuf_free (msr_tkbuf_t *);
+extern void msr_tkbuf_reset (msr_tkbuf_t *);
+extern uint8_t * msr_tkbuf_data (msr_tkbuf_t *);
+extern uint32_t msr_tkbuf_len (const msr_tkbuf_t *);
+extern uint32_t msr_tkbuf_size (const msr_tkbuf_t *);
+extern int msr_tkbuf_reserve (msr_tkbuf_t *, uint32_t);
+extern int msr_tkbuf_append (msr_tkbuf_t *, const void *, uint32_t);
+extern int msr_tkbuf_setlen (msr_tkbuf_t *, uint32_t);
+extern void msr_tkbuf_from_track (msr_tkbuf_t *, msr_track_t *);
+extern int msr_tkbuf_to_track (msr_tkbuf_t *, msr_track_t *);
+extern void msr_tkbufs_init (msr_tkbufs_t *);
+extern void msr_tkbufs_free (msr_tkbufs_t *);
+extern void msr_tkbufs_from_tracks (msr_tkbufs_t *, msr_tracks_t *);
+extern int msr_tkbufs_to_tracks (msr_tkbufs_t *, msr_tracks_t *);
+
+extern int msr_consensus_track (msr_tracks_t *, int, int, int, msr_track_t *,
+    uint8_t *);
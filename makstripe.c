@@ -61,8 +61,17 @@ int mak_flush(fd)
 	return r;
 }
 
+/*
+ * Read a card and collect the sample data the MAKStripe sends back.
+ * The 'RD ' response carries a 16 bit sample count, so the samples
+ * can run well past what an msr_track_t holds; they are stored in
+ * <samples>, two bytes per sample, as they came off the wire. If
+ * <samples> is NULL they are printed and discarded. If there is no
+ * room for them they are read and dropped, so the next command still
+ * finds the reader in step, and -2 is returned.
+ */
 int
-mak_read(int fd, uint8_t tracks)
+mak_read_samples(int fd, uint8_t tracks, msr_tkbuf_t *samples)
 {
 	int r;
 	int i;
@@ -70,6 +79,7 @@ mak_read(int fd, uint8_t tracks)
 	unsigned char sample_tmp[2];
 	uint16_t sample_count;
 	int sample_count_guessing;
+	int nomem = 0;
 	printf("Attempting to perform a read...\n");
 
 	r = mak_cmd(fd, MAKSTRIPE_READ_CMD, tracks);
@@ -100,10 +110,22 @@ mak_read(int fd, uint8_t tracks)
 	sample_count_guessing = ntohs(sample_count);
 	printf("Sample count appears to be: %d\n", sample_count_guessing);
 
-	/* XXX: We currently clobber the data. We don't return it. */
-	for (i = 0; i < sample_count_guessing ; i++) { /* Why is this off? sleeppppy... */
-		serial_read(fd, sample_tmp, 2);
-		printf("%d %02x %02x\n", i, sample_tmp[0], sample_tmp[1]);
+	if (samples != NULL) {
+		/* Read the samples straight into the buffer, in one go. */
+		msr_tkbuf_reset(samples);
+		nomem = msr_tkbuf_reserve(samples, sample_count_guessing * 2);
+	}
+	if (samples != NULL && !nomem) {
+		serial_read(fd, msr_tkbuf_data(samples), sample_count_guessing * 2);
+		msr_tkbuf_setlen(samples, sample_count_guessing * 2);
+	} else if (samples != NULL) {
+		for (i = 0; i < sample_count_guessing; i++)
+			serial_read(fd, sample_tmp, 2);
+	} else {
+		for (i = 0; i < sample_count_guessing ; i++) { /* Why is this off? sleeppppy... */
+			serial_read(fd, sample_tmp, 2);
+			printf("%d %02x %02x\n", i, sample_tmp[0], sample_tmp[1]);
+		}
 	}
 
 	printf("In theory, we have dumped the full sample data now...\n");
@@ -112,24 +134,38 @@ mak_read(int fd, uint8_t tracks)
 	printf("Sample read returned status: %s\n", buf);
 
 	r = memcmp(buf, MAKSTRIPE_READ_STS_OK, 5);
+	if (nomem)
+		return -2;
 	if (r != 0)
 		return -1;
 
 	return r;
 }
 
+int
+mak_read(int fd, uint8_t tracks)
+{
+	return mak_read_samples(fd, tracks, NULL);
+}
+
 /* The MAKStripe is a bit of a pain and has failures reading often. Wrap it.*/
 int
-mak_successful_read(int fd, uint8_t tracks)
+mak_successful_read_samples(int fd, uint8_t tracks, msr_tkbuf_t *samples)
 {
 	int r;
 	do {
 		mak_reset(fd);
-		r = mak_read(fd, tracks);
-	} while (r != 0);
+		r = mak_read_samples(fd, tracks, samples);
+	} while (r == -1);
 	return r;
 }
 
+int
+mak_successful_read(int fd, uint8_t tracks)
+{
+	return mak_successful_read_samples(fd, tracks, NULL);
+}
+
 /*
 int
 mak_write(int fd)
@@ -175,3 +175,13 @@ typedef struct mak_cmd_erase {
 #define MAKSTRIPE_eRASE_TK1_TK3	MAKSTRIPE_TK1 | MAKSTRIPE_TK3 /* Should be: 0x05 */
 #define MAKSTRIPE_eRASE_TK2_TK3	MAKSTRIPE_TK2 | MAKSTRIPE_TK3 /* Should be: 0x06 */
 #define MAKSTRIPE_eRASE_ALL	MAKSTRIPE_TK1 | MAKSTRIPE_TK2 | MAKSTRIPE_TK3 /*  etc: 0x07 */
+
+/* Every makstripe.c consumer must include libmsr.h before this file. */
+extern int mak_cmd(int, uint8_t, uint8_t);
+extern int mak_reset(int);
+extern int mak_read(int, uint8_t);
+extern int mak_read_samples(int, uint8_t, msr_tkbuf_t *);
+extern int mak_successful_read(int, uint8_t);
+extern int mak_successful_read_samples(int, uint8_t, msr_tkbuf_t *);
+extern int mak_clone(int);
+extern int mak_successful_clone(int);
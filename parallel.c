@@ -0,0 +1,154 @@
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "parallel.h"
+
+/*
+ * Simple fan-out helpers for spreading independent work items
+ * across all of the CPUs in the machine.
+ */
+
+/*
+ * Work items are handed out in chunks to limit locking. Chunks are
+ * at least this big, and big runs are cut into about this many
+ * chunks per thread so that threads finishing early can still help.
+ */
+#define MSR_PARALLEL_CHUNK	16
+#define MSR_PARALLEL_SPLIT	8
+
+/* Never start more workers than this, no matter what we're asked for. */
+#define MSR_PARALLEL_MAX	64
+
+typedef struct msr_parallel {
+	pthread_mutex_t	msr_pl_lock;
+	int		msr_pl_next;
+	int		msr_pl_count;
+	int		msr_pl_chunk;
+	msr_work_fn_t	msr_pl_fn;
+	void *		msr_pl_arg;
+} msr_parallel_t;
+
+/*
+ * Return the number of online CPUs, or 1 if that can't be determined.
+ */
+
+int
+msr_ncpus (void)
+{
+	long n;
+
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		return (1);
+	if (n > MSR_PARALLEL_MAX)
+		return (MSR_PARALLEL_MAX);
+
+	return ((int)n);
+}
+
+static void *
+worker (void * arg)
+{
+	msr_parallel_t * p = arg;
+	int first, last, i;
+
+	while (1) {
+		pthread_mutex_lock (&p->msr_pl_lock);
+		first = p->msr_pl_next;
+		last = first + p->msr_pl_chunk;
+		if (last > p->msr_pl_count || last < first)
+			last = p->msr_pl_count;
+		p->msr_pl_next = last;
+		pthread_mutex_unlock (&p->msr_pl_lock);
+
+		if (first >= last)
+			break;
+
+		for (i = first; i < last; i++)
+			p->msr_pl_fn (p->msr_pl_arg, i);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Run a work function over a range of indices
+ *
+ * This function calls <fn>(<arg>, i) for every i in [0, <count>),
+ * using up to <nthreads> threads. If <nthreads> is zero or less,
+ * one thread per online CPU is used. The calling thread takes part
+ * in the work, so a single thread request never spawns anything.
+ * Work items may complete in any order; <fn> must only touch state
+ * belonging to its own index.
+ *
+ * This function returns the number of threads that did the work,
+ * or -1 if no work could be done.
+ */
+
+int
+msr_parallel_for (int count, int nthreads, msr_work_fn_t fn, void * arg)
+{
+	return (msr_parallel_chunked (count, nthreads, 0, fn, arg));
+}
+
+/*
+ * Run a work function over a range of indices, <chunk> at a time
+ *
+ * This is msr_parallel_for() for work items big enough that handing
+ * them out in runs would leave threads idle: each worker takes
+ * <chunk> indices at a time, and no more threads are started than
+ * there are chunks. A <chunk> of zero or less picks one as
+ * msr_parallel_for() does.
+ */
+
+int
+msr_parallel_chunked (int count, int nthreads, int chunk, msr_work_fn_t fn,
+    void * arg)
+{
+	msr_parallel_t p;
+	pthread_t tids[MSR_PARALLEL_MAX];
+	int i, started;
+
+	if (count < 0 || fn == NULL)
+		return (-1);
+
+	if (nthreads <= 0)
+		nthreads = msr_ncpus ();
+	if (nthreads > MSR_PARALLEL_MAX)
+		nthreads = MSR_PARALLEL_MAX;
+	p.msr_pl_chunk = chunk > 0 ? chunk : MSR_PARALLEL_CHUNK;
+	if (nthreads > (count + p.msr_pl_chunk - 1) / p.msr_pl_chunk)
+		nthreads = (count + p.msr_pl_chunk - 1) / p.msr_pl_chunk;
+	if (nthreads < 1)
+		nthreads = 1;
+	if (chunk <= 0) {
+		p.msr_pl_chunk = count / (nthreads * MSR_PARALLEL_SPLIT);
+		if (p.msr_pl_chunk < MSR_PARALLEL_CHUNK)
+			p.msr_pl_chunk = MSR_PARALLEL_CHUNK;
+	}
+
+	pthread_mutex_init (&p.msr_pl_lock, NULL);
+	p.msr_pl_next = 0;
+	p.msr_pl_count = count;
+	p.msr_pl_fn = fn;
+	p.msr_pl_arg = arg;
+
+	/* If we can't get all the threads we want, make do with fewer. */
+	for (started = 0; started < nthreads - 1; started++) {
+		if (pthread_create (&tids[started], NULL, worker, &p) != 0)
+			break;
+	}
+
+	worker (&p);
+
+	for (i = 0; i < started; i++)
+		pthread_join (tids[i], NULL);
+
+	pthread_mutex_destroy (&p.msr_pl_lock);
+
+	return (started + 1);
+}
@@ -0,0 +1,15 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/*
+ * Work function for msr_parallel_for(). It is called once for every
+ * index in [0, count), from whichever worker thread picks it up.
+ */
+
+typedef void (*msr_work_fn_t) (void *, int);
+
+extern int msr_ncpus (void);
+extern int msr_parallel_for (int, int, msr_work_fn_t, void *);
+extern int msr_parallel_chunked (int, int, int, msr_work_fn_t, void *);
+
+#endif /* _PARALLEL_H_ */
@@ -0,0 +1,223 @@
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pcm.h"
+
+/*
+ * Audio scanning kernels.
+ *
+ * Nearly all of the time spent decoding audio goes into a handful of
+ * loops over the samples: looking for the loudest one, and looking
+ * for where the level crosses the silence threshold. These are those
+ * loops, done eight samples at a time with SSE2 where the compiler
+ * has it, and one at a time otherwise. The vector and scalar versions
+ * give the same answers; the scalar loop also finishes off whatever
+ * is left over at the end of a buffer.
+ *
+ * Rectification is folded into the comparisons: |s| > t is tested
+ * as s > t or s < -t, which also keeps -32768 from overflowing.
+ */
+
+/* Samples handled per step of the vector loops. */
+#define MSR_PCM_LANES	8
+
+#ifdef __SSE2__
+#define LOAD(p)		_mm_loadu_si128 ((const __m128i *)(p))
+
+/* Fold the eight lanes of <v> down to one with <op>. */
+#define REDUCE(v, op)							\
+	do {								\
+		v = op (v, _mm_srli_si128 (v, 8));			\
+		v = op (v, _mm_srli_si128 (v, 4));			\
+		v = op (v, _mm_srli_si128 (v, 2));			\
+	} while (0)
+#endif
+
+/* Return the largest sample in <s>, or 0 if there are none. */
+int
+msr_pcm_max (const int16_t * s, long n)
+{
+	long i = 0;
+	int max = -32768;
+
+	if (n <= 0)
+		return (0);
+
+#ifdef __SSE2__
+	if (n >= MSR_PCM_LANES) {
+		__m128i vmax = _mm_set1_epi16 (-32768);
+
+		for (; i + MSR_PCM_LANES <= n; i += MSR_PCM_LANES)
+			vmax = _mm_max_epi16 (vmax, LOAD (s + i));
+		REDUCE (vmax, _mm_max_epi16);
+		max = (int16_t)_mm_cvtsi128_si32 (vmax);
+	}
+#endif
+
+	for (; i < n; i++)
+		if (s[i] > max)
+			max = s[i];
+
+	return (max);
+}
+
+/* Return the largest absolute value in <s>, or 0 if there are none. */
+int
+msr_pcm_absmax (const int16_t * s, long n)
+{
+	long i = 0;
+	int max = 0, min = 0;
+
+#ifdef __SSE2__
+	if (n >= MSR_PCM_LANES) {
+		__m128i vmax = _mm_setzero_si128 ();
+		__m128i vmin = _mm_setzero_si128 ();
+		__m128i v;
+
+		for (; i + MSR_PCM_LANES <= n; i += MSR_PCM_LANES) {
+			v = LOAD (s + i);
+			vmax = _mm_max_epi16 (vmax, v);
+			vmin = _mm_min_epi16 (vmin, v);
+		}
+		REDUCE (vmax, _mm_max_epi16);
+		REDUCE (vmin, _mm_min_epi16);
+		max = (int16_t)_mm_cvtsi128_si32 (vmax);
+		min = (int16_t)_mm_cvtsi128_si32 (vmin);
+	}
+#endif
+
+	for (; i < n; i++) {
+		if (s[i] > max)
+			max = s[i];
+		if (s[i] < min)
+			min = s[i];
+	}
+
+	return (-min > max ? -min : max);
+}
+
+/*
+ * Return the index of the first sample in <s> above <thres>, or <n>
+ * if there isn't one.
+ */
+
+long
+msr_pcm_above (const int16_t * s, long n, int thres)
+{
+	long i = 0;
+
+	if (thres < 0)
+		return (0);
+	if (thres > 32767)
+		return (n);
+
+#ifdef __SSE2__
+	{
+		__m128i hi = _mm_set1_epi16 ((int16_t)thres);
+		__m128i lo = _mm_set1_epi16 ((int16_t)-thres);
+		__m128i v, m;
+
+		for (; i + MSR_PCM_LANES <= n; i += MSR_PCM_LANES) {
+			v = LOAD (s + i);
+			m = _mm_or_si128 (_mm_cmpgt_epi16 (v, hi),
+			    _mm_cmplt_epi16 (v, lo));
+			if (_mm_movemask_epi8 (m) != 0)
+				break;
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		if (s[i] > thres || s[i] < -thres)
+			return (i);
+
+	return (n);
+}
+
+/*
+ * Return the index of the first sample in <s> at or below <thres>, or
+ * <n> if there isn't one.
+ */
+
+long
+msr_pcm_below (const int16_t * s, long n, int thres)
+{
+	long i = 0;
+
+	if (thres < 0)
+		return (n);
+	if (thres > 32767)
+		return (0);
+
+#ifdef __SSE2__
+	{
+		__m128i hi = _mm_set1_epi16 ((int16_t)thres);
+		__m128i lo = _mm_set1_epi16 ((int16_t)-thres);
+		__m128i v, m;
+
+		for (; i + MSR_PCM_LANES <= n; i += MSR_PCM_LANES) {
+			v = LOAD (s + i);
+			m = _mm_or_si128 (_mm_cmpgt_epi16 (v, hi),
+			    _mm_cmplt_epi16 (v, lo));
+			if (_mm_movemask_epi8 (m) != 0xffff)
+				break;
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		if (s[i] <= thres && s[i] >= -thres)
+			return (i);
+
+	return (n);
+}
+
+/*
+ * Find the loudest sample in <s>
+ *
+ * This function returns the index of the first sample with the
+ * largest absolute value in <s>, and stores that value in <level>.
+ * If <n> is zero, it returns -1 and stores 0.
+ */
+
+long
+msr_pcm_peak (const int16_t * s, long n, int * level)
+{
+	long i;
+	int max;
+
+	*level = 0;
+	if (n <= 0)
+		return (-1);
+
+	/* One pass for the level, a second to find where it is. */
+	max = msr_pcm_absmax (s, n);
+	*level = max;
+	i = msr_pcm_above (s, n, max - 1);
+
+	return (i < n ? i : 0);
+}
+
+/*
+ * Copy channel <ch> of the <n> frames of <channels> interleaved samples
+ * in <in> to <out>.
+ */
+
+void
+msr_pcm_deinterleave (const int16_t * in, long n, int channels, int ch,
+    int16_t * out)
+{
+	long i;
+
+	in += ch;
+	for (i = 0; i < n; i++, in += channels)
+		out[i] = *in;
+}
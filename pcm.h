@@ -0,0 +1,17 @@
+#ifndef _PCM_H_
+#define _PCM_H_
+
+/*
+ * Scanning kernels for signed 16 bit audio. Levels are compared after
+ * rectification, so a sample is "above" <thres> if its absolute value
+ * is greater than <thres>.
+ */
+
+extern int msr_pcm_max (const int16_t *, long);
+extern int msr_pcm_absmax (const int16_t *, long);
+extern long msr_pcm_above (const int16_t *, long, int);
+extern long msr_pcm_below (const int16_t *, long, int);
+extern long msr_pcm_peak (const int16_t *, long, int *);
+extern void msr_pcm_deinterleave (const int16_t *, long, int, int, int16_t *);
+
+#endif /* _PCM_H_ */
@@ -0,0 +1,196 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pcmmap.h"
+
+/*
+ * Memory mapped recordings.
+ *
+ * Reading a recording through libsndfile means a buffer the size of
+ * the file, and a copy of every sample into it, before decoding can
+ * start; an archive of long recordings spends as much time copying
+ * as decoding, and twice the memory. But most recordings are WAV
+ * files of 16 bit samples, which on a little endian machine are
+ * already laid out the way the decoder wants them. For those, we map
+ * the file and hand out a pointer to its samples; pages come in from
+ * the page cache as the decoder gets to them, and nothing is copied.
+ *
+ * Anything else (compressed formats, other sample sizes, big endian
+ * hosts) is turned down with a reason, and can be read through
+ * libsndfile as before.
+ */
+
+/* WAV format tags for plain PCM. */
+#define MSR_PCMMAP_PCM		0x0001
+#define MSR_PCMMAP_EXTENSIBLE	0xfffe
+
+static uint32_t
+le16 (const unsigned char * p)
+{
+	return (p[0] | p[1] << 8);
+}
+
+static uint32_t
+le32 (const unsigned char * p)
+{
+	return (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+/*
+ * Find the samples in the WAV file mapped at <pm>. Returns the offset
+ * of the first one and sets the frame count, or returns 0 and sets
+ * the error.
+ */
+
+static size_t
+wav (msr_pcmmap_t * pm)
+{
+	const unsigned char * p = pm->msr_pm_base;
+	size_t off = 12, len = pm->msr_pm_len, n;
+	int fmt = 0, block = 0;
+
+	while (off + 8 <= len) {
+		n = le32 (p + off + 4);
+		off += 8;
+
+		if (memcmp (p + off - 8, "fmt ", 4) == 0) {
+			if (n < 16 || off + 16 > len)
+				break;
+			fmt = le16 (p + off);
+			pm->msr_pm_channels = le16 (p + off + 2);
+			pm->msr_pm_rate = le32 (p + off + 4);
+			block = le16 (p + off + 12);
+			if ((fmt != MSR_PCMMAP_PCM &&
+			    fmt != MSR_PCMMAP_EXTENSIBLE) ||
+			    le16 (p + off + 14) != 16 ||
+			    pm->msr_pm_channels < 1 ||
+			    block != 2 * pm->msr_pm_channels) {
+				pm->msr_pm_error = "Not 16 bit PCM";
+				return (0);
+			}
+		} else if (memcmp (p + off - 8, "data", 4) == 0) {
+			if (block == 0)
+				break;
+
+			/* Files still being written say 0 or ~0. */
+			if (n > len - off)
+				n = len - off;
+			pm->msr_pm_frames = n / block;
+			return (off);
+		}
+
+		/* Chunks are padded to an even length. */
+		if (n > len - off)
+			break;
+		off += n + (n & 1);
+	}
+
+	pm->msr_pm_error = "Bad WAV file";
+	return (0);
+}
+
+/*
+ * Map a recording
+ *
+ * This function maps the file at <path> and points <pm> at its
+ * samples. A WAV file describes itself; any other file is taken to be
+ * raw samples in <channels> channels, or turned down if <channels> is
+ * zero. The map stays valid until msr_pcmmap_close().
+ *
+ * This function will fail, setting msr_pm_error, if the file can't be
+ * mapped or isn't 16 bit PCM in the machine's byte order.
+ */
+
+int
+msr_pcmmap_open (msr_pcmmap_t * pm, const char * path, int channels)
+{
+	struct stat st;
+	union {
+		uint16_t	u;
+		unsigned char	c[2];
+	} order;
+	size_t off = 0;
+	int fd;
+
+	memset (pm, 0, sizeof (msr_pcmmap_t));
+
+	order.u = 1;
+	if (order.c[0] != 1) {
+		pm->msr_pm_error = "Not a little endian machine";
+		return (-1);
+	}
+
+	fd = open (path, O_RDONLY);
+	if (fd == -1) {
+		pm->msr_pm_error = "Can't open file";
+		return (-1);
+	}
+	if (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode) || st.st_size < 1) {
+		close (fd);
+		pm->msr_pm_error = "Not a file that can be mapped";
+		return (-1);
+	}
+
+	pm->msr_pm_len = st.st_size;
+	pm->msr_pm_base = mmap (NULL, pm->msr_pm_len, PROT_READ, MAP_SHARED,
+	    fd, 0);
+	close (fd);
+	if (pm->msr_pm_base == MAP_FAILED) {
+		pm->msr_pm_base = NULL;
+		pm->msr_pm_error = "Can't map file";
+		return (-1);
+	}
+
+	if (pm->msr_pm_len >= 12 &&
+	    memcmp (pm->msr_pm_base, "RIFF", 4) == 0 &&
+	    memcmp ((char *)pm->msr_pm_base + 8, "WAVE", 4) == 0) {
+		off = wav (pm);
+		if (off == 0)
+			goto fail;
+	} else if (channels > 0) {
+		pm->msr_pm_raw = 1;
+		pm->msr_pm_channels = channels;
+		pm->msr_pm_frames = pm->msr_pm_len / 2 / channels;
+	} else {
+		pm->msr_pm_error = "Not a WAV file";
+		goto fail;
+	}
+
+	/* The samples can be used in place only if they are aligned. */
+	if (off & 1) {
+		pm->msr_pm_error = "Samples not aligned";
+		goto fail;
+	}
+	pm->msr_pm_data = (const int16_t *)((char *)pm->msr_pm_base + off);
+
+#ifdef POSIX_MADV_SEQUENTIAL
+	/* Decoding runs straight through; read ahead. */
+	posix_madvise (pm->msr_pm_base, pm->msr_pm_len,
+	    POSIX_MADV_SEQUENTIAL);
+#endif
+
+	return (0);
+
+fail:
+	munmap (pm->msr_pm_base, pm->msr_pm_len);
+	pm->msr_pm_base = NULL;
+	return (-1);
+}
+
+void
+msr_pcmmap_close (msr_pcmmap_t * pm)
+{
+	if (pm->msr_pm_base != NULL)
+		munmap (pm->msr_pm_base, pm->msr_pm_len);
+	pm->msr_pm_base = NULL;
+	pm->msr_pm_data = NULL;
+	pm->msr_pm_frames = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef _PCMMAP_H_
+#define _PCMMAP_H_
+
+/*
+ * A 16 bit PCM recording mapped straight from its file: either a WAV
+ * file of little endian 16 bit PCM, or a raw file of nothing but
+ * interleaved samples. The samples are read through msr_pm_data, in
+ * place, for as long as the map is open.
+ */
+
+typedef struct msr_pcmmap {
+	void *			msr_pm_base;	/* Whole file, as mapped */
+	size_t			msr_pm_len;
+	const int16_t *		msr_pm_data;	/* First sample */
+	long			msr_pm_frames;
+	int			msr_pm_channels;
+	int			msr_pm_rate;	/* 0 for a raw file */
+	int			msr_pm_raw;	/* No header */
+	const char *		msr_pm_error;	/* Why the open failed */
+} msr_pcmmap_t;
+
+extern int msr_pcmmap_open (msr_pcmmap_t *, const char *, int);
+extern void msr_pcmmap_close (msr_pcmmap_t *);
+
+#endif /* _PCMMAP_H_ */
@@ -0,0 +1,133 @@
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pcm.h"
+#include "segment.h"
+
+/*
+ * The silence after a swipe is found by counting quiet frames as they
+ * go by, rather than by looking back over the last msr_sg_endlen of
+ * them, so each frame is looked at once however long the swipes and
+ * the silence are. Runs of quiet frames are skipped with the pcm
+ * kernels.
+ */
+
+/*
+ * Set up a segmenter for frames of <channels> interleaved samples,
+ * with a silence threshold of <thres>, ending a swipe at <endlen>
+ * quiet frames.
+ */
+
+void
+msr_segment_init (msr_segment_t * sg, int thres, int channels, long endlen)
+{
+	sg->msr_sg_thres = thres;
+	sg->msr_sg_channels = channels;
+	sg->msr_sg_endlen = endlen > 0 ? endlen : 1;
+	msr_segment_reset (sg);
+}
+
+/* Forget any swipe in progress, and count frames from here. */
+void
+msr_segment_reset (msr_segment_t * sg)
+{
+	sg->msr_sg_quiet = 0;
+	sg->msr_sg_pos = 0;
+	sg->msr_sg_inswipe = 0;
+	sg->msr_sg_ready = 0;
+	sg->msr_sg_start = 0;
+	sg->msr_sg_end = 0;
+}
+
+/*
+ * Start a swipe at the next frame, for a caller that has found the
+ * start some other way and only wants the end.
+ */
+
+void
+msr_segment_begin (msr_segment_t * sg)
+{
+	sg->msr_sg_inswipe = 1;
+	sg->msr_sg_quiet = 0;
+	sg->msr_sg_start = sg->msr_sg_pos;
+}
+
+/*
+ * Scan frames for swipes
+ *
+ * This function scans up to <count> frames of <frames>, which carry on
+ * from those it was last given, and returns how many it took. It
+ * stops early at the end of a swipe, setting msr_sg_ready, with
+ * msr_sg_start and msr_sg_end saying where the swipe was; the frames
+ * not taken are to be given again. msr_sg_ready stays set until the
+ * next call.
+ */
+
+long
+msr_segment_push (msr_segment_t * sg, const int16_t * frames, long count)
+{
+	long i = 0, j, k, n, left;
+	int ch = sg->msr_sg_channels;
+
+	sg->msr_sg_ready = 0;
+
+	/* Skip the silence before the swipe. */
+	if (!sg->msr_sg_inswipe) {
+		k = msr_pcm_above (frames, count * ch, sg->msr_sg_thres);
+		if (k == count * ch) {
+			sg->msr_sg_pos += count;
+			return (count);
+		}
+		i = k / ch;
+		sg->msr_sg_inswipe = 1;
+		sg->msr_sg_quiet = 0;
+		sg->msr_sg_start = sg->msr_sg_pos + i;
+	}
+
+	/* Count the quiet frames from one loud frame to the next. */
+	for (j = i; j < count; j += n + 1) {
+		k = msr_pcm_above (frames + j * ch, (count - j) * ch,
+		    sg->msr_sg_thres);
+		n = k / ch;
+		left = sg->msr_sg_endlen - sg->msr_sg_quiet;
+		if (n >= left) {
+			sg->msr_sg_pos += j + left;
+			sg->msr_sg_end = sg->msr_sg_pos;
+			sg->msr_sg_inswipe = 0;
+			sg->msr_sg_ready = 1;
+			return (j + left);
+		}
+		if (k == (count - j) * ch) {
+			sg->msr_sg_quiet += n;
+			break;
+		}
+		sg->msr_sg_quiet = 0;
+	}
+
+	sg->msr_sg_pos += count;
+
+	return (count);
+}
+
+/*
+ * End the swipe in progress, if there is one, as at the end of the
+ * input. Returns 1 if one was, setting msr_sg_ready as
+ * msr_segment_push() does, or 0 if not.
+ */
+
+int
+msr_segment_finish (msr_segment_t * sg)
+{
+	sg->msr_sg_ready = 0;
+	if (sg->msr_sg_inswipe) {
+		sg->msr_sg_end = sg->msr_sg_pos;
+		sg->msr_sg_inswipe = 0;
+		sg->msr_sg_ready = 1;
+	}
+
+	return (sg->msr_sg_ready);
+}
@@ -0,0 +1,38 @@
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+/*
+ * Swipe segmentation.
+ *
+ * A long recording, or a capture left running, holds any number of
+ * swipes with silence between them. Frames go in a chunk at a time,
+ * and the segmenter says where each swipe began and ended, counted in
+ * frames from the first one it was given. A frame is loud if any of
+ * its channels is above the silence threshold; a swipe starts at a
+ * loud frame and ends once msr_sg_endlen quiet frames have followed
+ * its last loud one, those frames included.
+ *
+ * This is the one place swipes are told from silence: msr_audio
+ * contexts, dab's captures and dab's long recordings all go through
+ * it.
+ */
+
+typedef struct msr_segment {
+	int	msr_sg_thres;		/* Silence threshold */
+	int	msr_sg_channels;	/* Samples per frame */
+	long	msr_sg_endlen;		/* Quiet frames ending a swipe */
+	long	msr_sg_quiet;		/* ... seen so far */
+	long	msr_sg_pos;		/* Frames scanned */
+	int	msr_sg_inswipe;		/* Past the silence before a swipe */
+	int	msr_sg_ready;		/* A swipe has just ended */
+	long	msr_sg_start;		/* First frame of the last swipe */
+	long	msr_sg_end;		/* Frame after its end */
+} msr_segment_t;
+
+extern void msr_segment_init (msr_segment_t *, int, int, long);
+extern void msr_segment_reset (msr_segment_t *);
+extern void msr_segment_begin (msr_segment_t *);
+extern long msr_segment_push (msr_segment_t *, const int16_t *, long);
+extern int msr_segment_finish (msr_segment_t *);
+
+#endif /* _SEGMENT_H_ */
@@ -0,0 +1,241 @@
+#include <sys/types.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmsr.h"
+#include "synth.h"
+
+/*
+ * Synthetic swipes.
+ *
+ * Decoders are hard to measure against real swipes: no two are alike,
+ * and nobody knows what the bits really were. These are swipes made
+ * up from known bits, as many and as alike as wanted, with the things
+ * that make real ones hard dialled in: sample rate against bit
+ * density and card speed (how many samples a bit gets), the speed
+ * changing along the swipe, a weak head, noise, and transitions that
+ * land off the beat.
+ *
+ * A bit cell is 1 / (bpi * speed) seconds long, with the speed taken
+ * at that point of the swipe. Every cell starts with a transition,
+ * a one has another in the middle, and one more closes the last cell.
+ * Each transition is a gaussian pulse, of the opposite sign to the
+ * last one, and as wide as msr_sy_width of the bit it is in.
+ *
+ * Noise and jitter are gaussian, from a generator seeded by the
+ * caller, so the same settings always give the same samples.
+ */
+
+/* Pulses are cut off this many widths from their centre. */
+#define MSR_SYNTH_REACH		4
+
+/* <math.h> only has M_PI outside strict ANSI. */
+#define MSR_SYNTH_PI		3.14159265358979323846
+
+void
+msr_synth_init (msr_synth_t * sy)
+{
+	sy->msr_sy_rate = 192000;
+	sy->msr_sy_bpi = 75;		/* Track 2 */
+	sy->msr_sy_speed = 20;
+	sy->msr_sy_endspeed = 20;
+	sy->msr_sy_profile = MSR_SYNTH_CONSTANT;
+	sy->msr_sy_amp = 20000;
+	sy->msr_sy_width = 0.125;
+	sy->msr_sy_noise = 0;
+	sy->msr_sy_jitter = 0;
+	sy->msr_sy_lead = 20;
+	sy->msr_sy_silence = 0.3;
+	sy->msr_sy_seed = 1;
+}
+
+/*
+ * Encode a track
+ *
+ * This function encodes the characters of <str>, sentinels included,
+ * as characters of <bpc> bits (5 or 7), adds the LRC, and stores the
+ * bits in <bits>, which holds <size> bytes. It returns the number of
+ * bits stored, or -1 if a character can't be encoded or the bits
+ * don't fit.
+ */
+
+long
+msr_synth_track (const char * str, int bpc, uint8_t * bits, long size)
+{
+	uint8_t chars[MSR_MAX_TRACK_LEN], len;
+	int base, n, i, lrc = 0;
+
+	if (bpc == 5)
+		base = 0x30;
+	else if (bpc == 7)
+		base = 0x20;
+	else
+		return (-1);
+
+	n = strlen (str);
+	if (n + 1 > MSR_MAX_TRACK_LEN)
+		return (-1);
+
+	for (i = 0; i < n; i++) {
+		if (str[i] < base || str[i] >= base + (1 << (bpc - 1)))
+			return (-1);
+		chars[i] = str[i];
+		lrc ^= str[i] - base;
+	}
+	chars[n++] = base + lrc;
+
+	len = size > MSR_MAX_TRACK_LEN ? MSR_MAX_TRACK_LEN : size;
+	if (msr_encode (chars, n, bits, &len, bpc) == -1)
+		return (-1);
+
+	return ((long)n * bpc);
+}
+
+/* Samples per bit, <i> bits into a swipe of <n>. */
+static double
+cell (const msr_synth_t * sy, long i, long n)
+{
+	double x = n > 1 ? (double)i / (n - 1) : 0, v = sy->msr_sy_speed;
+
+	if (sy->msr_sy_profile == MSR_SYNTH_RAMP)
+		v += (sy->msr_sy_endspeed - sy->msr_sy_speed) * x;
+	else if (sy->msr_sy_profile == MSR_SYNTH_ARC)
+		v += (sy->msr_sy_endspeed - sy->msr_sy_speed) *
+		    sin (MSR_SYNTH_PI * x);
+
+	return (sy->msr_sy_rate / (sy->msr_sy_bpi * v));
+}
+
+/*
+ * Return the number of samples msr_synth_render() needs for a swipe
+ * of <nbits> bits, the silence at either end included.
+ */
+
+long
+msr_synth_length (const msr_synth_t * sy, long nbits)
+{
+	double t, max = 0, c;
+	long i, n = nbits + 2 * sy->msr_sy_lead;
+
+	t = 2 * sy->msr_sy_silence * sy->msr_sy_rate;
+	for (i = 0; i < n; i++) {
+		c = cell (sy, i, n);
+		t += c;
+		if (c > max)
+			max = c;
+	}
+
+	/* The last pulse, and any jitter, can run past the last cell. */
+	return ((long)ceil (t + max));
+}
+
+/* Next number from the generator, uniform in (0, 1]. */
+static double
+uniform (msr_synth_t * sy)
+{
+	uint32_t x = sy->msr_sy_seed;
+
+	/* Marsaglia's xorshift; it must never be zero. */
+	if (x == 0)
+		x = 1;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sy->msr_sy_seed = x;
+
+	return ((x >> 8) / 16777216.0 + 1 / 33554432.0);
+}
+
+/* Next number from the generator, normal with a deviation of one. */
+static double
+gauss (msr_synth_t * sy)
+{
+	double u = uniform (sy), v = uniform (sy);
+
+	return (sqrt (-2 * log (u)) * cos (2 * MSR_SYNTH_PI * v));
+}
+
+/*
+ * Render a swipe
+ *
+ * This function renders a swipe of the <nbits> bits in <bits>, with
+ * msr_sy_lead clocking zeros either side, into <out>, which holds
+ * <size> samples. Samples past the end of <out> are dropped. It
+ * returns the number of samples stored: msr_synth_length(), if
+ * there is room.
+ *
+ * This function will fail if memory can't be allocated.
+ */
+
+long
+msr_synth_render (msr_synth_t * sy, const uint8_t * bits, long nbits,
+    int16_t * out, long size)
+{
+	double * at, * wd, t, c, s, d, reach = 0;
+	long n, nt = 0, i, k, lo, len;
+	int b;
+
+	n = nbits + 2 * sy->msr_sy_lead;
+	at = malloc (sizeof (double) * (2 * n + 1));
+	wd = malloc (sizeof (double) * (2 * n + 1));
+	if (at == NULL || wd == NULL) {
+		free (at);
+		free (wd);
+		return (-1);
+	}
+
+	/* Where the transitions are, and how wide. */
+	t = sy->msr_sy_silence * sy->msr_sy_rate;
+	for (i = 0; i < n; i++) {
+		c = cell (sy, i, n);
+		b = 0;
+		if (i >= sy->msr_sy_lead && i < sy->msr_sy_lead + nbits) {
+			k = i - sy->msr_sy_lead;
+			b = bits[k / 8] >> (7 - k % 8) & 1;
+		}
+
+		at[nt] = t + sy->msr_sy_jitter * c * gauss (sy);
+		wd[nt++] = sy->msr_sy_width * c;
+		if (b) {
+			at[nt] = t + c / 2 + sy->msr_sy_jitter * c * gauss (sy);
+			wd[nt++] = sy->msr_sy_width * c;
+		}
+		t += c;
+		if (sy->msr_sy_width * c > reach)
+			reach = sy->msr_sy_width * c;
+	}
+	at[nt] = t;
+	wd[nt] = wd[nt - 1];
+	nt++;
+	reach *= MSR_SYNTH_REACH;
+
+	len = msr_synth_length (sy, nbits);
+	if (len > size)
+		len = size;
+
+	for (k = 0, lo = 0; k < len; k++) {
+		while (lo < nt && at[lo] + reach < k)
+			lo++;
+
+		s = 0;
+		for (i = lo; i < nt && at[i] - reach <= k; i++) {
+			d = (k - at[i]) / wd[i];
+			s += (i & 1 ? -1 : 1) * sy->msr_sy_amp *
+			    exp (-d * d / 2);
+		}
+		if (sy->msr_sy_noise > 0)
+			s += sy->msr_sy_noise * gauss (sy);
+
+		s = floor (s + 0.5);
+		out[k] = s > 32767 ? 32767 : s < -32767 ? -32767 : (int16_t)s;
+	}
+
+	free (at);
+	free (wd);
+
+	return (len);
+}
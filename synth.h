@@ -0,0 +1,38 @@
+#ifndef _SYNTH_H_
+#define _SYNTH_H_
+
+/*
+ * Synthetic swipes: the head output of a stripe of Aiken biphase (F2F)
+ * bits going by, as 16 bit PCM. Every transition in the flux is a
+ * pulse, alternating in sign, whose width scales with the bit length.
+ * The bits are packed, most significant bit first, as msr_encode()
+ * and msr_audio_bits() produce them.
+ */
+
+/* How the speed of the card changes along the swipe. */
+#define MSR_SYNTH_CONSTANT	0	/* msr_sy_speed throughout */
+#define MSR_SYNTH_RAMP		1	/* msr_sy_speed to msr_sy_endspeed */
+#define MSR_SYNTH_ARC		2	/* ... and back again, like a hand */
+
+typedef struct msr_synth {
+	int		msr_sy_rate;	/* Sample rate (hz) */
+	double		msr_sy_bpi;	/* Bit density (bits per inch) */
+	double		msr_sy_speed;	/* Card speed (inches per second) */
+	double		msr_sy_endspeed; /* ... for a ramp or arc */
+	int		msr_sy_profile;	/* MSR_SYNTH_* */
+	int		msr_sy_amp;	/* Pulse height */
+	double		msr_sy_width;	/* Pulse width (fraction of a bit) */
+	double		msr_sy_noise;	/* Noise (standard deviation) */
+	double		msr_sy_jitter;	/* Timing jitter (fraction of a bit) */
+	int		msr_sy_lead;	/* Clocking zeros at either end */
+	double		msr_sy_silence;	/* Seconds of silence at either end */
+	uint32_t	msr_sy_seed;	/* Noise and jitter come from here */
+} msr_synth_t;
+
+extern void msr_synth_init (msr_synth_t *);
+extern long msr_synth_track (const char *, int, uint8_t *, long);
+extern long msr_synth_length (const msr_synth_t *, long);
+extern long msr_synth_render (msr_synth_t *, const uint8_t *, long,
+    int16_t *, long);
+
+#endif /* _SYNTH_H_ */
@@ -0,0 +1,267 @@
+#include <sys/types.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmsr.h"
+
+/*
+ * Variable length track and sample buffers.
+ *
+ * An msr_track_t can hold at most MSR_MAX_TRACK_LEN bytes, but some
+ * devices (the MAKStripe, for one) hand us far more than that. An
+ * msr_tkbuf_t keeps short data inside the structure, so an ordinary
+ * three track read never touches the heap, and only moves to heap
+ * storage once the data outgrows it. Heap storage is kept across
+ * msr_tkbuf_reset() calls so that a buffer reused for card after
+ * card stops allocating once it has seen the longest one.
+ *
+ * A buffer can also borrow the storage of an existing msr_track_t,
+ * in which case reads and writes go straight to the track.
+ */
+
+/* Smallest heap allocation we bother making. */
+#define MSR_TKBUF_MIN_HEAP	1024
+
+void
+msr_tkbuf_init (msr_tkbuf_t * tb)
+{
+	tb->msr_tb_where = MSR_TKBUF_WHERE_INLINE;
+	tb->msr_tb_len = 0;
+	tb->msr_tb_heap = NULL;
+	tb->msr_tb_heap_size = 0;
+	tb->msr_tb_track = NULL;
+}
+
+/* Release any heap storage and return the buffer to its initial state. */
+void
+msr_tkbuf_free (msr_tkbuf_t * tb)
+{
+	free (tb->msr_tb_heap);
+	msr_tkbuf_init (tb);
+}
+
+/*
+ * Empty the buffer for reuse. Heap storage is kept, so the next
+ * fill of a similar size does not have to allocate again.
+ */
+
+void
+msr_tkbuf_reset (msr_tkbuf_t * tb)
+{
+	tb->msr_tb_len = 0;
+	tb->msr_tb_track = NULL;
+	tb->msr_tb_where = tb->msr_tb_heap != NULL ?
+	    MSR_TKBUF_WHERE_HEAP : MSR_TKBUF_WHERE_INLINE;
+}
+
+uint8_t *
+msr_tkbuf_data (msr_tkbuf_t * tb)
+{
+	switch (tb->msr_tb_where) {
+	case MSR_TKBUF_WHERE_HEAP:
+		return (tb->msr_tb_heap);
+	case MSR_TKBUF_WHERE_TRACK:
+		return (tb->msr_tb_track->msr_tk_data);
+	default:
+		return (tb->msr_tb_inline);
+	}
+}
+
+/* Return how many bytes the buffer holds. */
+uint32_t
+msr_tkbuf_len (const msr_tkbuf_t * tb)
+{
+	return (tb->msr_tb_len);
+}
+
+/* Return how many bytes the buffer can hold without growing. */
+uint32_t
+msr_tkbuf_size (const msr_tkbuf_t * tb)
+{
+	switch (tb->msr_tb_where) {
+	case MSR_TKBUF_WHERE_HEAP:
+		return (tb->msr_tb_heap_size);
+	case MSR_TKBUF_WHERE_TRACK:
+		return (MSR_MAX_TRACK_LEN);
+	default:
+		return (MSR_TKBUF_INLINE);
+	}
+}
+
+/*
+ * Make sure the buffer can hold at least <size> bytes
+ *
+ * If the current storage is too small, the contents are moved to
+ * heap storage, which grows by doubling. A borrowed track is left
+ * as it was at the time of the move.
+ *
+ * This function will fail if memory can't be allocated.
+ */
+
+int
+msr_tkbuf_reserve (msr_tkbuf_t * tb, uint32_t size)
+{
+	uint8_t * p;
+	uint32_t n;
+
+	if (size <= msr_tkbuf_size (tb))
+		return (0);
+
+	if (size > tb->msr_tb_heap_size) {
+		n = tb->msr_tb_heap_size ? tb->msr_tb_heap_size :
+		    MSR_TKBUF_MIN_HEAP;
+		while (n < size)
+			n *= 2;
+
+		if (tb->msr_tb_where == MSR_TKBUF_WHERE_HEAP)
+			p = realloc (tb->msr_tb_heap, n);
+		else {
+			/* Nothing in the old heap block is worth keeping. */
+			free (tb->msr_tb_heap);
+			tb->msr_tb_heap = NULL;
+			tb->msr_tb_heap_size = 0;
+			p = malloc (n);
+		}
+		if (p == NULL)
+			return (-1);
+		tb->msr_tb_heap = p;
+		tb->msr_tb_heap_size = n;
+	}
+
+	if (tb->msr_tb_where != MSR_TKBUF_WHERE_HEAP) {
+		memcpy (tb->msr_tb_heap, msr_tkbuf_data (tb), tb->msr_tb_len);
+		tb->msr_tb_where = MSR_TKBUF_WHERE_HEAP;
+		tb->msr_tb_track = NULL;
+	}
+
+	return (0);
+}
+
+/*
+ * Append <len> bytes from <data> to the buffer, growing it if need be.
+ *
+ * This function will fail if memory can't be allocated.
+ */
+
+int
+msr_tkbuf_append (msr_tkbuf_t * tb, const void * data, uint32_t len)
+{
+	if (msr_tkbuf_reserve (tb, tb->msr_tb_len + len) == -1)
+		return (-1);
+
+	memcpy (msr_tkbuf_data (tb) + tb->msr_tb_len, data, len);
+	tb->msr_tb_len += len;
+	if (tb->msr_tb_where == MSR_TKBUF_WHERE_TRACK)
+		tb->msr_tb_track->msr_tk_len = tb->msr_tb_len;
+
+	return (0);
+}
+
+/*
+ * Set the length of the buffer's contents, for data written in place
+ * through msr_tkbuf_data() after msr_tkbuf_reserve().
+ *
+ * This function will fail if <len> is more than the buffer holds.
+ */
+
+int
+msr_tkbuf_setlen (msr_tkbuf_t * tb, uint32_t len)
+{
+	if (len > msr_tkbuf_size (tb))
+		return (-1);
+
+	tb->msr_tb_len = len;
+	if (tb->msr_tb_where == MSR_TKBUF_WHERE_TRACK)
+		tb->msr_tb_track->msr_tk_len = tb->msr_tb_len;
+
+	return (0);
+}
+
+/*
+ * Point the buffer at the contents of <track> without copying it.
+ * Changes made through the buffer show up in the track for as long
+ * as the data fits; see msr_tkbuf_to_track().
+ */
+
+void
+msr_tkbuf_from_track (msr_tkbuf_t * tb, msr_track_t * track)
+{
+	tb->msr_tb_where = MSR_TKBUF_WHERE_TRACK;
+	tb->msr_tb_track = track;
+	tb->msr_tb_len = track->msr_tk_len;
+}
+
+/*
+ * Store the buffer contents in <track>
+ *
+ * If the buffer is borrowing <track> already, only the length is
+ * updated and nothing is copied.
+ *
+ * This function will fail if the data is longer than
+ * MSR_MAX_TRACK_LEN bytes.
+ */
+
+int
+msr_tkbuf_to_track (msr_tkbuf_t * tb, msr_track_t * track)
+{
+	if (tb->msr_tb_len > MSR_MAX_TRACK_LEN)
+		return (-1);
+
+	if (tb->msr_tb_where != MSR_TKBUF_WHERE_TRACK ||
+	    tb->msr_tb_track != track)
+		memcpy (track->msr_tk_data, msr_tkbuf_data (tb),
+		    tb->msr_tb_len);
+	track->msr_tk_len = tb->msr_tb_len;
+
+	return (0);
+}
+
+void
+msr_tkbufs_init (msr_tkbufs_t * tbs)
+{
+	int i;
+
+	for (i = 0; i < MSR_MAX_TRACKS; i++)
+		msr_tkbuf_init (&tbs->msr_tkbufs[i]);
+}
+
+void
+msr_tkbufs_free (msr_tkbufs_t * tbs)
+{
+	int i;
+
+	for (i = 0; i < MSR_MAX_TRACKS; i++)
+		msr_tkbuf_free (&tbs->msr_tkbufs[i]);
+}
+
+void
+msr_tkbufs_from_tracks (msr_tkbufs_t * tbs, msr_tracks_t * tracks)
+{
+	int i;
+
+	for (i = 0; i < MSR_MAX_TRACKS; i++)
+		msr_tkbuf_from_track (&tbs->msr_tkbufs[i],
+		    &tracks->msr_tracks[i]);
+}
+
+/*
+ * Store all of the buffers in <tracks>. Every track that fits is
+ * stored; the function fails if any of them did not.
+ */
+
+int
+msr_tkbufs_to_tracks (msr_tkbufs_t * tbs, msr_tracks_t * tracks)
+{
+	int i, r = 0;
+
+	for (i = 0; i < MSR_MAX_TRACKS; i++)
+		if (msr_tkbuf_to_track (&tbs->msr_tkbufs[i],
+		    &tracks->msr_tracks[i]) == -1)
+			r = -1;
+
+	return (r);
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "libmsr.h"
+
+/* How many of the ranked hypotheses to show for each file. */
+#define SHOW_HYPOTHESES 3
+
+int main(int argc, char **argv)
+{
+	msr_track_t *tracks;
+	msr_hypothesis_t *hyps, *h;
+	int ntracks, fd, i, j;
+	ssize_t r;
+
+	if (argc < 2)
+	{
+		printf("Usage: %s [file1] ... [fileN]\n", argv[0]);
+		exit(1);
+	}
+
+	ntracks = argc - 1;
+	tracks = calloc(ntracks, sizeof(msr_track_t));
+	hyps = calloc(ntracks * MSR_INFER_CANDIDATES, sizeof(msr_hypothesis_t));
+	if (tracks == NULL || hyps == NULL)
+	{
+		printf("Out of memory.\n");
+		exit(1);
+	}
+
+	/* Each file holds a single raw track, as dumped by the reader. */
+	for (i = 0; i < ntracks; i++)
+	{
+		fd = open(argv[i + 1], O_RDONLY);
+		if (fd == -1)
+		{
+			perror(argv[i + 1]);
+			continue;
+		}
+		r = read(fd, tracks[i].msr_tk_data, MSR_MAX_TRACK_LEN);
+		tracks[i].msr_tk_len = r > 0 ? r : 0;
+		close(fd);
+	}
+
+	msr_infer_tracks(tracks, ntracks, hyps, 0);
+
+	for (i = 0; i < ntracks; i++)
+	{
+		printf("%s [%d bytes]\n", argv[i + 1], tracks[i].msr_tk_len);
+		for (j = 0; j < SHOW_HYPOTHESES; j++)
+		{
+			h = &hyps[i * MSR_INFER_CANDIDATES + j];
+			printf("  bpc %d offset %d %s: score %d, parity %d/%d%s%s%s\n",
+			    h->msr_hy_bpc, h->msr_hy_offset,
+			    h->msr_hy_reversed ? "reverse" : "forward",
+			    h->msr_hy_score, h->msr_hy_parity_ok, h->msr_hy_chars,
+			    h->msr_hy_flags & MSR_HY_SS ? ", start sentinel" : "",
+			    h->msr_hy_flags & MSR_HY_ES ? ", end sentinel" : "",
+			    h->msr_hy_flags & MSR_HY_LRC ? ", LRC ok" : "");
+		}
+	}
+
+	free(hyps);
+	free(tracks);
+
+	return 0;
+}
@@ -18,6 +18,8 @@ int main(int argc, char * argv[])
 	int fd = -1;
 	int serial;
 	int ret;
+	msr_tkbuf_t samples;
+	FILE *f;
 
 	/* Default device selection per platform */
 #ifdef __linux__
@@ -37,11 +39,27 @@ int main(int argc, char * argv[])
 		err(1, "Serial open of %s failed", device);
 		exit(1);
 	}
+	if (argc > 2)
+		printf("Saving the samples read to %s\n", argv[2]);
 	printf("Ready to populate MAKStripe buffer...\n");
-	ret = mak_successful_read(fd, MAKSTRIPE_TK_ALL);
+	msr_tkbuf_init(&samples);
+	ret = mak_successful_read_samples(fd, MAKSTRIPE_TK_ALL,
+	    argc > 2 ? &samples : NULL);
 	if (ret != 0) {
 		printf("Unable to populate MAKStripe buffer!\n");
-		exit(ret);
+		exit(1);
+	}
+
+	/* Keep what the head saw, two bytes a sample, as they were sent. */
+	if (argc > 2) {
+		f = fopen(argv[2], "wb");
+		if (f == NULL || fwrite(msr_tkbuf_data(&samples), 1,
+		    msr_tkbuf_len(&samples), f) != msr_tkbuf_len(&samples) ||
+		    fclose(f) == EOF)
+			err(1, "%s", argv[2]);
+		printf("Wrote %u sample bytes to %s\n",
+		    (unsigned)msr_tkbuf_len(&samples), argv[2]);
+		msr_tkbuf_free(&samples);
 	}
 	printf("Ready to clone buffer onto blank card...\n");
 	ret = mak_successful_clone(fd);
@@ -167,10 +167,10 @@ do {
 	}
 	/* dump the bytes as a hexdump */
 	printf("Hex output:\n");
-	msr_pretty_printer_hex(tracks);
+	msr_print_hex(stdout, &tracks);
 	/* dump the bytes as a string */
 	printf("String output:\n");
-	msr_pretty_printer_string(tracks);
+	msr_print_string(stdout, &tracks);
 } while (1);
 	/* We're finished */
 	serial_close (fd);
@@ -0,0 +1,247 @@
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pcm.h"
+
+/*
+ * Check the pcm kernels against plain loops.
+ *
+ * libmsr's pcm kernels run eight samples at a time where the compiler
+ * has SSE2, finishing off with a scalar loop. Each is run here on
+ * buffers of every length up to a few vectors, at every alignment,
+ * filled with random samples, silence, full scale samples of either
+ * sign (-32768 included) and a single loud sample at each position,
+ * against every threshold that is an edge case, and the answers are
+ * compared with those of the obvious one sample at a time loop. Any
+ * difference is printed, and the exit status is 1 if there were any.
+ */
+
+/* Longest buffer tried, and the most it is offset from the start. */
+#define MAXLEN		80
+#define MAXOFF		7
+
+/* Random fills of each length. */
+#define ROUNDS		64
+
+/* Most channels tried when deinterleaving. */
+#define MAXCH		4
+
+static const int thresholds[] = {
+	-1, 0, 1, 2, 100, 5000, 16384, 32766, 32767, 32768
+};
+#define NTHRES	(sizeof(thresholds) / sizeof(thresholds[0]))
+
+/* Fills. */
+#define RANDOM		0
+#define SMALL		1
+#define SILENT		2
+#define TOP		3
+#define BOTTOM		4
+#define EXTREMES	5
+#define NFILLS		6
+
+static const char * fillnames[] = {
+	"random", "small", "silent", "top", "bottom", "extremes"
+};
+
+static unsigned long seed = 1;
+static long failures, checks;
+
+/* The same samples on every run, whatever the C library. */
+static int
+rnd (void)
+{
+	seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+	return ((int)(seed >> 16) & 0xffff);
+}
+
+static int
+ref_max (const int16_t * s, long n)
+{
+	long i;
+	int max = -32768;
+
+	if (n <= 0)
+		return (0);
+	for (i = 0; i < n; i++)
+		if (s[i] > max)
+			max = s[i];
+	return (max);
+}
+
+static int
+ref_absmax (const int16_t * s, long n)
+{
+	long i;
+	int max = 0;
+
+	for (i = 0; i < n; i++)
+		if (abs (s[i]) > max)
+			max = abs (s[i]);
+	return (max);
+}
+
+static long
+ref_above (const int16_t * s, long n, int thres)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+		if (abs (s[i]) > thres)
+			return (i);
+	return (n);
+}
+
+static long
+ref_below (const int16_t * s, long n, int thres)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+		if (abs (s[i]) <= thres)
+			return (i);
+	return (n);
+}
+
+static long
+ref_peak (const int16_t * s, long n, int * level)
+{
+	long i, at = 0;
+
+	*level = 0;
+	if (n <= 0)
+		return (-1);
+	for (i = 0; i < n; i++)
+		if (abs (s[i]) > *level) {
+			*level = abs (s[i]);
+			at = i;
+		}
+	return (at);
+}
+
+static void
+fail (const char * kernel, int fill, long off, long n, int arg,
+    long got, long want)
+{
+	failures++;
+	printf("%s\t%s\toffset %ld\tlength %ld\targ %d\tgot %ld\twant %ld\n",
+	    kernel, fillnames[fill], off, n, arg, got, want);
+}
+
+static void
+fill (int16_t * s, long n, int how)
+{
+	long i;
+
+	for (i = 0; i < n; i++) {
+		switch (how) {
+		case RANDOM:
+			s[i] = (int16_t)(rnd () - 32768);
+			break;
+		case SMALL:
+			s[i] = (int16_t)(rnd () % 201 - 100);
+			break;
+		case SILENT:
+			s[i] = 0;
+			break;
+		case TOP:
+			s[i] = 32767;
+			break;
+		case BOTTOM:
+			s[i] = -32768;
+			break;
+		case EXTREMES:
+			s[i] = rnd () & 1 ? 32767 : -32768;
+			break;
+		}
+	}
+}
+
+static void
+check (const int16_t * s, long n, int how, long off)
+{
+	int16_t out[MAXLEN + 1], want[MAXLEN + 1];
+	long got, ref;
+	int a, b;
+	unsigned t;
+	int ch, c;
+
+	checks++;
+
+	if ((got = msr_pcm_max (s, n)) != (ref = ref_max (s, n)))
+		fail ("max", how, off, n, 0, got, ref);
+	if ((got = msr_pcm_absmax (s, n)) != (ref = ref_absmax (s, n)))
+		fail ("absmax", how, off, n, 0, got, ref);
+
+	for (t = 0; t < NTHRES; t++) {
+		if ((got = msr_pcm_above (s, n, thresholds[t])) !=
+		    (ref = ref_above (s, n, thresholds[t])))
+			fail ("above", how, off, n, thresholds[t], got, ref);
+		if ((got = msr_pcm_below (s, n, thresholds[t])) !=
+		    (ref = ref_below (s, n, thresholds[t])))
+			fail ("below", how, off, n, thresholds[t], got, ref);
+	}
+
+	got = msr_pcm_peak (s, n, &a);
+	ref = ref_peak (s, n, &b);
+	if (got != ref)
+		fail ("peak", how, off, n, 0, got, ref);
+	if (a != b)
+		fail ("peak level", how, off, n, 0, a, b);
+
+	for (ch = 1; ch <= MAXCH; ch++)
+		for (c = 0; c < ch; c++) {
+			memset (out, 0, sizeof(out));
+			memset (want, 0, sizeof(want));
+			msr_pcm_deinterleave (s, n / ch, ch, c, out);
+			for (got = 0; got < n / ch; got++)
+				want[got] = s[got * ch + c];
+			if (memcmp (out, want, sizeof(out)) != 0)
+				fail ("deinterleave", how, off, n, ch * 10 + c,
+				    0, 0);
+		}
+}
+
+int
+main (int argc, char * argv[])
+{
+	int16_t buf[MAXOFF + MAXLEN];
+	long n, off, i;
+	int how, r;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [seed]\n", argv[0]);
+		return (2);
+	}
+	if (argc == 2)
+		seed = strtoul (argv[1], NULL, 0);
+
+	for (n = 0; n <= MAXLEN; n++)
+		for (off = 0; off <= MAXOFF; off++)
+			for (how = 0; how < NFILLS; how++)
+				for (r = 0; r < (how <= SMALL ? ROUNDS : 1);
+				    r++) {
+					fill (buf + off, n, how);
+					check (buf + off, n, how, off);
+				}
+
+	/* One loud sample, or two of opposite sign, in the quiet. */
+	for (n = 1; n <= MAXLEN; n++)
+		for (i = 0; i < n; i++) {
+			fill (buf, n, SILENT);
+			buf[i] = -32768;
+			check (buf, n, BOTTOM, 0);
+			buf[i] = 32767;
+			check (buf, n, TOP, 0);
+			buf[n - 1 - i] = -32767;
+			check (buf, n, EXTREMES, 0);
+		}
+
+	printf("%ld buffers checked, %ld differences\n", checks, failures);
+
+	return (failures != 0);
+}
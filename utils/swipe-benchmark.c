@@ -0,0 +1,463 @@
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "libmsr.h"
+#include "synth.h"
+#include "audio.h"
+#include "pcmmap.h"
+
+/*
+ * Benchmark the audio decoder.
+ *
+ * Every combination of sample rate, frequency threshold, silence
+ * threshold, noise, jitter and decoding mode (as the swipe goes by,
+ * or by maximum likelihood once it has ended) given is a cell of the
+ * matrix. Each cell
+ * renders a number of synthetic swipes of a known track, each with its
+ * own noise and jitter, and decodes them one after another through a
+ * single msr_audio_t, as a reader would; only the decoding is timed.
+ * Recordings named on the command line are decoded at each frequency
+ * and silence threshold, at their own rate.
+ *
+ * One line of tab separated values is printed per cell, under a line
+ * of column names, so runs from different releases can be compared
+ * with nothing more than a spreadsheet or awk. Bit errors are counted
+ * against the bits that were sent, so they are only known for
+ * synthetic swipes; recordings show "-".
+ */
+
+/* Most values in a list option. */
+#define MAXLIST		16
+
+/* Decoding modes. */
+#define GREEDY		0
+#define VITERBI		1
+
+static const char * modenames[] = { "greedy", "viterbi" };
+
+/* Default track: a track 2 test card. */
+#define TRACK		";4111111111111111=2512101?"
+
+struct list {
+	double	v[MAXLIST];
+	int	pct[MAXLIST];	/* Silence threshold as pct of the max */
+	int	n;
+};
+
+struct result {
+	long	swipes;
+	long	samples;
+	long	bits;
+	long	sent;		/* Bits sent, for the error rate */
+	long	errors;
+	long	tracks;		/* Swipes whose track parsed */
+	long	allocs;
+	double	secs;
+};
+
+static void usage (FILE * f, const char * name)
+{
+	fprintf (f, "Usage: %s [options] [recording.wav ...]\n", name);
+	fputs (
+	    "  -r, --rates LIST       sample rates (48000,96000,192000)\n"
+	    "  -f, --freq-thres LIST  allowed period deviation, pct (60)\n"
+	    "  -T, --thres LIST       silence thresholds; N% for a pct of\n"
+	    "                         the highest sample (5000,30%)\n"
+	    "  -n, --noise LIST       noise, standard deviation (0,250,500,"
+	    "1000)\n"
+	    "  -j, --jitter LIST      jitter, fraction of a bit (0,0.02)\n"
+	    "  -m, --modes LIST       greedy and/or viterbi (greedy)\n", f);
+	fputs (
+	    "  -N, --swipes N         synthetic swipes per cell (10)\n"
+	    "  -k, --track STRING     track to swipe (" TRACK ")\n"
+	    "  -s, --speed IPS        card speed (20)\n"
+	    "  -e, --end-speed IPS    ... at the end or middle of the swipe\n"
+	    "  -p, --profile NAME     constant, ramp or arc (constant)\n"
+	    "  -i, --interpolate      place peaks between samples\n"
+	    "  -S, --no-synthetic     only decode the recordings\n"
+	    "  -h, --help             this\n", f);
+}
+
+/* Parse a comma separated list of numbers, some perhaps with a '%'. */
+static void parse_list (struct list * l, const char * s, const char * what)
+{
+	char * end;
+
+	for (l->n = 0; *s != '\0'; s = end + (*end == ',')) {
+		if (l->n == MAXLIST)
+			errx (1, "Too many %s", what);
+		l->v[l->n] = strtod (s, &end);
+		if (end == s)
+			errx (1, "Bad %s: %s", what, s);
+		l->pct[l->n] = *end == '%';
+		end += l->pct[l->n];
+		if (*end != ',' && *end != '\0')
+			errx (1, "Bad %s: %s", what, s);
+		l->n++;
+	}
+	if (l->n == 0)
+		errx (1, "No %s", what);
+}
+
+/* Parse a comma separated list of decoding modes into <modes>. */
+static int parse_modes (int * modes, char * s)
+{
+	char * m;
+	int n = 0;
+
+	for (m = strtok (s, ","); m != NULL; m = strtok (NULL, ",")) {
+		if (n == 2)
+			errx (1, "Too many modes");
+		if (strcmp (m, modenames[GREEDY]) == 0)
+			modes[n++] = GREEDY;
+		else if (strcmp (m, modenames[VITERBI]) == 0)
+			modes[n++] = VITERBI;
+		else
+			errx (1, "Unknown mode %s", m);
+	}
+	if (n == 0)
+		errx (1, "No modes");
+
+	return (n);
+}
+
+static double now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+#define BIT(bits, i)	((bits)[(i) / 8] >> (7 - (i) % 8) & 1)
+
+/*
+ * Count the bits of the <nbits> sent, after <lead> clocking zeros, that
+ * didn't come back in the <ngot> decoded. The decoder may drop or add
+ * a clocking bit or two, so the best alignment within the clocking
+ * bits is taken; bits that never came back at all are errors too.
+ */
+
+static long errors (const uint8_t * sent, long nbits, int lead,
+    const uint8_t * got, long ngot)
+{
+	long best = nbits, e, j, k;
+	int o;
+
+	for (o = -lead; o <= lead; o++) {
+		for (e = 0, j = 0; j < nbits && e < best; j++) {
+			k = lead + j + o;
+			if (k >= ngot || BIT (sent, j) != BIT (got, k))
+				e++;
+		}
+		if (e < best)
+			best = e;
+	}
+
+	return (best);
+}
+
+/*
+ * Decode the <n> samples in <s>, adding up what was found in <r>. For
+ * a synthetic swipe, <sent> holds the <nsent> bits that were sent; if
+ * noise broke it up, the best of the pieces is the one counted.
+ */
+
+static void decode (msr_audio_t * au, const int16_t * s, long n, int bpc,
+    struct result * r, const uint8_t * sent, long nsent, int lead)
+{
+	char out[MSR_MAX_TRACK_LEN + 1];
+	const uint8_t * bits;
+	long i, nbits, allocs = au->msr_au_allocs, best = nsent, e;
+	double t;
+	int k, chunk;
+
+	for (i = 0; ; i += k) {
+		/* msr_audio_push() takes an int's worth at a time. */
+		chunk = n - i > 1 << 20 ? 1 << 20 : n - i;
+
+		t = now ();
+		if (chunk > 0)
+			k = msr_audio_push (au, s + i, chunk);
+		else
+			k = msr_audio_finish (au) == -1 ? -1 : 0;
+		r->secs += now () - t;
+		if (k == -1)
+			errx (1, "Out of memory");
+
+		nbits = msr_audio_bits (au, &bits);
+		if (nbits != -1) {
+			r->swipes++;
+			r->bits += nbits;
+			if (msr_audio_parse (bits, nbits, bpc, 0, out,
+			    sizeof (out)) != -1)
+				r->tracks++;
+			if (sent != NULL) {
+				e = errors (sent, nsent, lead, bits, nbits);
+				if (e < best)
+					best = e;
+			}
+			msr_audio_next (au);
+		} else if (chunk == 0)
+			break;
+	}
+
+	if (sent != NULL) {
+		r->sent += nsent;
+		r->errors += best;
+	}
+	r->samples += n;
+	r->allocs += au->msr_au_allocs - allocs;
+}
+
+/* The silence threshold for <s>: as given, or a pct of its highest. */
+static int threshold (const int16_t * s, long n, double thres, int pct)
+{
+	long i;
+	int max = 0;
+
+	if (!pct)
+		return ((int)thres);
+
+	for (i = 0; i < n; i++)
+		if (abs (s[i]) > max)
+			max = abs (s[i]);
+
+	return ((int)(thres * max / 100));
+}
+
+/* Set up <au> for a cell. */
+static void setup (msr_audio_t * au, int rate, int thres, int freq,
+    int interp, int mode, int bpc)
+{
+	if (msr_audio_init (au, rate, thres, freq) == -1)
+		errx (1, "Bad settings");
+	msr_biphase_interp (&au->msr_au_bp, interp);
+	msr_audio_viterbi (au, mode == VITERBI, bpc);
+}
+
+static void print (const char * source, int mode, int rate, double freq,
+    double thres, int pct, const char * noise, const char * jitter,
+    struct result * r)
+{
+	double secs = r->secs > 0 ? r->secs : 1e-9;
+
+	printf ("%s\t%s\t%d\t%g\t%g%s\t%s\t%s\t%ld\t%ld\t%ld\t%.6f\t%.0f\t"
+	    "%.0f\t", source, modenames[mode], rate, freq, thres,
+	    pct ? "%" : "", noise, jitter,
+	    r->swipes, r->samples, r->bits, r->secs, r->samples / secs,
+	    r->bits / secs);
+	if (r->sent > 0)
+		printf ("%ld\t%.6f\t", r->errors, (double)r->errors / r->sent);
+	else
+		printf ("-\t-\t");
+	printf ("%ld\t%.2f\t%.1f\n", r->tracks,
+	    r->swipes > 0 ? (double)r->allocs / r->swipes : 0.0,
+	    r->swipes > 0 ? r->secs * 1e6 / r->swipes : 0.0);
+	fflush (stdout);
+}
+
+int main (int argc, char * argv[])
+{
+	struct list rates, freqs, thres, noise, jitter;
+	struct result r;
+	msr_synth_t sy, base;
+	msr_audio_t au;
+	msr_pcmmap_t pm;
+	uint8_t bits[MSR_MAX_TRACK_LEN];
+	char nbuf[32], jbuf[32];
+	const char * track = TRACK;
+	const int16_t * p;
+	int16_t * s, * mono;
+	long nbits, n, i, k;
+	int swipes = 10, interp = 0, synthetic = 1, bpc, ch;
+	int modes[2] = { GREEDY }, nmodes = 1, cells;
+	int a, b, c, d, e, m, t;
+	static struct option opts[] = {
+		{ "rates",		1, 0, 'r' },
+		{ "freq-thres",		1, 0, 'f' },
+		{ "thres",		1, 0, 'T' },
+		{ "noise",		1, 0, 'n' },
+		{ "jitter",		1, 0, 'j' },
+		{ "modes",		1, 0, 'm' },
+		{ "swipes",		1, 0, 'N' },
+		{ "track",		1, 0, 'k' },
+		{ "speed",		1, 0, 's' },
+		{ "end-speed",		1, 0, 'e' },
+		{ "profile",		1, 0, 'p' },
+		{ "interpolate",	0, 0, 'i' },
+		{ "no-synthetic",	0, 0, 'S' },
+		{ "help",		0, 0, 'h' },
+		{ 0,			0, 0, 0 }
+	};
+
+	msr_synth_init (&base);
+	parse_list (&rates, "48000,96000,192000", "rates");
+	parse_list (&freqs, "60", "frequency thresholds");
+	parse_list (&thres, "5000,30%", "silence thresholds");
+	parse_list (&noise, "0,250,500,1000", "noise levels");
+	parse_list (&jitter, "0,0.02", "jitter levels");
+
+	t = 0;
+	while ((ch = getopt_long (argc, argv, "r:f:T:n:j:m:N:k:s:e:p:iSh",
+	    opts, NULL)) != -1) {
+		switch (ch) {
+		case 'r':
+			parse_list (&rates, optarg, "rates");
+			break;
+		case 'f':
+			parse_list (&freqs, optarg, "frequency thresholds");
+			break;
+		case 'T':
+			parse_list (&thres, optarg, "silence thresholds");
+			break;
+		case 'n':
+			parse_list (&noise, optarg, "noise levels");
+			break;
+		case 'j':
+			parse_list (&jitter, optarg, "jitter levels");
+			break;
+		case 'm':
+			nmodes = parse_modes (modes, optarg);
+			break;
+		case 'N':
+			swipes = atoi (optarg);
+			break;
+		case 'k':
+			track = optarg;
+			break;
+		case 's':
+			base.msr_sy_speed = atof (optarg);
+			break;
+		case 'e':
+			base.msr_sy_endspeed = atof (optarg);
+			t = 1;
+			break;
+		case 'p':
+			if (strcmp (optarg, "constant") == 0)
+				base.msr_sy_profile = MSR_SYNTH_CONSTANT;
+			else if (strcmp (optarg, "ramp") == 0)
+				base.msr_sy_profile = MSR_SYNTH_RAMP;
+			else if (strcmp (optarg, "arc") == 0)
+				base.msr_sy_profile = MSR_SYNTH_ARC;
+			else
+				errx (1, "Unknown profile %s", optarg);
+			break;
+		case 'i':
+			interp = 1;
+			break;
+		case 'S':
+			synthetic = 0;
+			break;
+		case 'h':
+			usage (stdout, argv[0]);
+			exit (0);
+		default:
+			usage (stderr, argv[0]);
+			exit (1);
+		}
+	}
+	if (!t)
+		base.msr_sy_endspeed = base.msr_sy_speed;
+	if (swipes < 1 || base.msr_sy_speed <= 0 || base.msr_sy_endspeed <= 0)
+		errx (1, "Nothing to swipe");
+
+	bpc = track[0] == '%' ? 7 : 5;
+	nbits = msr_synth_track (track, bpc, bits, sizeof (bits));
+	if (nbits == -1)
+		errx (1, "Can't encode %s", track);
+
+	printf ("source\tmode\trate\tfreq_thres\tthres\tnoise\tjitter\tswipes\t"
+	    "samples\tbits\tseconds\tsamples_per_sec\tbits_per_sec\t"
+	    "bit_errors\tber\ttracks_ok\tallocs_per_swipe\tusec_per_swipe\n");
+
+	for (a = 0; synthetic && a < rates.n; a++) {
+		base.msr_sy_rate = (int)rates.v[a];
+		n = msr_synth_length (&base, nbits);
+		s = malloc (n * sizeof (int16_t));
+		if (s == NULL)
+			errx (1, "Out of memory");
+
+		/* The modes of a cell side by side, on the same swipes. */
+		cells = nmodes * freqs.n * thres.n * noise.n * jitter.n;
+		for (k = 0; k < cells; k++) {
+			m = modes[k % nmodes];
+			e = k / nmodes % jitter.n;
+			d = k / nmodes / jitter.n % noise.n;
+			c = k / nmodes / jitter.n / noise.n % thres.n;
+			b = k / nmodes / jitter.n / noise.n / thres.n;
+
+			memset (&r, 0, sizeof (r));
+			for (t = 0; t < swipes; t++) {
+				sy = base;
+				sy.msr_sy_noise = noise.v[d];
+				sy.msr_sy_jitter = jitter.v[e];
+				sy.msr_sy_seed = t + 1;
+				if (msr_synth_render (&sy, bits, nbits, s, n) == -1)
+					errx (1, "Out of memory");
+
+				/* One context for the cell, as for one head. */
+				if (t == 0)
+					setup (&au, sy.msr_sy_rate,
+					    threshold (s, n, thres.v[c],
+					    thres.pct[c]), (int)freqs.v[b],
+					    interp, m, bpc);
+				decode (&au, s, n, bpc, &r, bits, nbits,
+				    sy.msr_sy_lead);
+			}
+			msr_audio_free (&au);
+
+			sprintf (nbuf, "%g", noise.v[d]);
+			sprintf (jbuf, "%g", jitter.v[e]);
+			print ("synthetic", m, base.msr_sy_rate, freqs.v[b],
+			    thres.v[c], thres.pct[c], nbuf, jbuf, &r);
+		}
+		free (s);
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (msr_pcmmap_open (&pm, argv[i], 1) == -1)
+			errx (1, "%s: %s", argv[i], pm.msr_pm_error);
+		if (pm.msr_pm_rate == 0)
+			pm.msr_pm_rate = (int)rates.v[rates.n - 1];
+
+		/* Only the first channel is decoded. */
+		mono = NULL;
+		if (pm.msr_pm_channels > 1) {
+			mono = malloc (pm.msr_pm_frames * sizeof (int16_t));
+			if (mono == NULL)
+				errx (1, "Out of memory");
+			for (k = 0; k < pm.msr_pm_frames; k++)
+				mono[k] = pm.msr_pm_data[k * pm.msr_pm_channels];
+		}
+
+		p = mono != NULL ? mono : pm.msr_pm_data;
+		for (k = 0; k < nmodes * freqs.n * thres.n; k++) {
+			m = modes[k % nmodes];
+			c = k / nmodes % thres.n;
+			b = k / nmodes / thres.n;
+
+			memset (&r, 0, sizeof (r));
+			setup (&au, pm.msr_pm_rate, threshold (p,
+			    pm.msr_pm_frames, thres.v[c], thres.pct[c]),
+			    (int)freqs.v[b], interp, m, bpc);
+			decode (&au, p, pm.msr_pm_frames, bpc, &r, NULL, 0, 0);
+			msr_audio_free (&au);
+			print (argv[i], m, pm.msr_pm_rate, freqs.v[b],
+			    thres.v[c], thres.pct[c], "-", "-", &r);
+		}
+
+		free (mono);
+		msr_pcmmap_close (&pm);
+	}
+
+	return (0);
+}
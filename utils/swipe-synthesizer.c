@@ -0,0 +1,288 @@
+#include <sys/types.h>
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "libmsr.h"
+#include "synth.h"
+#include "audio.h"
+
+/*
+ * Make a swipe up: the bits of an ISO track, or any bits at all, as a
+ * head would hear them go by. The samples are written to a WAV or raw
+ * file that dab can read, or fed straight to the audio decoder to see
+ * whether it gets the bits back.
+ */
+
+static void usage (FILE * f, const char * name)
+{
+	fprintf (f, "Usage: %s [options] (-t track | -B bits) [out.wav]\n",
+	    name);
+	fputs (
+	    "  -t, --track STRING     ISO track, sentinels included\n"
+	    "  -c, --bpc N            bits per character (default: from"
+	    " the sentinel)\n"
+	    "  -B, --bits STRING      bits as 0s and 1s, sent as they are\n"
+	    "  -r, --rate HZ          sample rate (default 192000)\n"
+	    "  -d, --density BPI      bits per inch (default 75)\n"
+	    "  -s, --speed IPS        card speed (default 20)\n"
+	    "  -e, --end-speed IPS    speed at the end of a ramp, or the\n"
+	    "                         middle of an arc\n", f);
+	fputs (
+	    "  -p, --profile NAME     constant, ramp or arc\n"
+	    "  -a, --amplitude N      pulse height (default 20000)\n"
+	    "  -w, --width F          pulse width, as a fraction of a bit\n"
+	    "  -n, --noise N          noise, as a standard deviation\n"
+	    "  -j, --jitter F         jitter, as a fraction of a bit\n"
+	    "  -S, --seed N           seed for the noise and jitter\n"
+	    "  -R, --raw              write raw samples, not WAV\n"
+	    "  -D, --decode           decode in memory instead of writing\n"
+	    "  -h, --help             this\n", f);
+}
+
+static void le16 (unsigned char * p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void le32 (unsigned char * p, uint32_t v)
+{
+	le16 (p, v);
+	le16 (p + 2, v >> 16);
+}
+
+/* The 44 byte header of a mono 16 bit PCM WAV file. */
+static void wav_header (unsigned char * h, int rate, long samples)
+{
+	memcpy (h, "RIFF", 4);
+	le32 (h + 4, 36 + samples * 2);
+	memcpy (h + 8, "WAVEfmt ", 8);
+	le32 (h + 16, 16);
+	le16 (h + 20, 1);
+	le16 (h + 22, 1);
+	le32 (h + 24, rate);
+	le32 (h + 28, rate * 2);
+	le16 (h + 32, 2);
+	le16 (h + 34, 16);
+	memcpy (h + 36, "data", 4);
+	le32 (h + 40, samples * 2);
+}
+
+/* Write <n> samples to <f>, little endian whatever the host. */
+static int write_samples (FILE * f, const int16_t * s, long n)
+{
+	unsigned char b[2];
+	long i;
+
+	for (i = 0; i < n; i++) {
+		le16 (b, (uint16_t)s[i]);
+		if (fwrite (b, 2, 1, f) != 1)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/* Decode the swipe with the audio decoder and print what it found. */
+static int decode (msr_synth_t * sy, const int16_t * s, long n,
+    const char * track, int bpc)
+{
+	msr_audio_t au;
+	const uint8_t * bits;
+	char out[MSR_MAX_TRACK_LEN + 1];
+	long nbits, i;
+	int r = 0, len;
+
+	if (msr_audio_init (&au, sy->msr_sy_rate, MSR_AUDIO_THRES,
+	    MSR_AUDIO_FREQ_THRES) == -1)
+		return (-1);
+
+	for (i = 0; i < n; i += r) {
+		r = msr_audio_push (&au, s + i, n - i);
+		if (r == -1 || r < n - i)
+			break;
+	}
+	if (r == -1 || msr_audio_finish (&au) == -1 ||
+	    (nbits = msr_audio_bits (&au, &bits)) == -1) {
+		msr_audio_free (&au);
+		printf ("no swipe\n");
+		return (-1);
+	}
+
+	printf ("%ld bits\n", nbits);
+	r = 0;
+	if (bpc) {
+		len = msr_audio_parse (bits, nbits, bpc, 0, out, sizeof (out));
+		printf ("%s\n", len == -1 ? "no track" : out);
+		if (len == -1 || (track != NULL && strcmp (out, track) != 0))
+			r = -1;
+	} else {
+		for (i = 0; i < nbits; i++)
+			putchar ('0' + (bits[i / 8] >> (7 - i % 8) & 1));
+		putchar ('\n');
+	}
+
+	msr_audio_free (&au);
+
+	return (r);
+}
+
+int main (int argc, char * argv[])
+{
+	msr_synth_t sy;
+	uint8_t bits[MSR_MAX_TRACK_LEN];
+	unsigned char h[44];
+	int16_t * s;
+	char * track = NULL, * raw = NULL;
+	int bpc = 0, rawfile = 0, check = 0, ch, i, end = 0;
+	long nbits, n;
+	FILE * f;
+	static struct option opts[] = {
+		{ "track",	1, 0, 't' },
+		{ "bpc",	1, 0, 'c' },
+		{ "bits",	1, 0, 'B' },
+		{ "rate",	1, 0, 'r' },
+		{ "density",	1, 0, 'd' },
+		{ "speed",	1, 0, 's' },
+		{ "end-speed",	1, 0, 'e' },
+		{ "profile",	1, 0, 'p' },
+		{ "amplitude",	1, 0, 'a' },
+		{ "width",	1, 0, 'w' },
+		{ "noise",	1, 0, 'n' },
+		{ "jitter",	1, 0, 'j' },
+		{ "seed",	1, 0, 'S' },
+		{ "raw",	0, 0, 'R' },
+		{ "decode",	0, 0, 'D' },
+		{ "help",	0, 0, 'h' },
+		{ 0,		0, 0, 0 }
+	};
+
+	msr_synth_init (&sy);
+
+	while ((ch = getopt_long (argc, argv, "t:c:B:r:d:s:e:p:a:w:n:j:S:RDh",
+	    opts, NULL)) != -1) {
+		switch (ch) {
+		case 't':
+			track = optarg;
+			break;
+		case 'c':
+			bpc = atoi (optarg);
+			break;
+		case 'B':
+			raw = optarg;
+			break;
+		case 'r':
+			sy.msr_sy_rate = atoi (optarg);
+			break;
+		case 'd':
+			sy.msr_sy_bpi = atof (optarg);
+			break;
+		case 's':
+			sy.msr_sy_speed = atof (optarg);
+			break;
+		case 'e':
+			sy.msr_sy_endspeed = atof (optarg);
+			end = 1;
+			break;
+		case 'p':
+			if (strcmp (optarg, "constant") == 0)
+				sy.msr_sy_profile = MSR_SYNTH_CONSTANT;
+			else if (strcmp (optarg, "ramp") == 0)
+				sy.msr_sy_profile = MSR_SYNTH_RAMP;
+			else if (strcmp (optarg, "arc") == 0)
+				sy.msr_sy_profile = MSR_SYNTH_ARC;
+			else
+				errx (1, "Unknown profile %s", optarg);
+			break;
+		case 'a':
+			sy.msr_sy_amp = atoi (optarg);
+			break;
+		case 'w':
+			sy.msr_sy_width = atof (optarg);
+			break;
+		case 'n':
+			sy.msr_sy_noise = atof (optarg);
+			break;
+		case 'j':
+			sy.msr_sy_jitter = atof (optarg);
+			break;
+		case 'S':
+			sy.msr_sy_seed = strtoul (optarg, NULL, 0);
+			break;
+		case 'R':
+			rawfile = 1;
+			break;
+		case 'D':
+			check = 1;
+			break;
+		case 'h':
+			usage (stdout, argv[0]);
+			exit (0);
+		default:
+			usage (stderr, argv[0]);
+			exit (1);
+		}
+	}
+
+	if ((track == NULL) == (raw == NULL) || (!check && optind != argc - 1) ||
+	    sy.msr_sy_rate < 1 || sy.msr_sy_bpi <= 0 || sy.msr_sy_speed <= 0) {
+		usage (stderr, argv[0]);
+		exit (1);
+	}
+	if (!end)
+		sy.msr_sy_endspeed = sy.msr_sy_speed;
+	if (sy.msr_sy_endspeed <= 0)
+		errx (1, "The card must keep moving");
+
+	if (track != NULL) {
+		if (bpc == 0)
+			bpc = track[0] == '%' ? 7 : 5;
+		nbits = msr_synth_track (track, bpc, bits, sizeof (bits));
+		if (nbits == -1)
+			errx (1, "Can't encode %s in %d bit characters",
+			    track, bpc);
+	} else {
+		nbits = strlen (raw);
+		if (nbits > MSR_MAX_TRACK_BITS)
+			errx (1, "Too many bits");
+		memset (bits, 0, sizeof (bits));
+		for (i = 0; i < nbits; i++) {
+			if (raw[i] != '0' && raw[i] != '1')
+				errx (1, "Bits are 0 or 1");
+			if (raw[i] == '1')
+				bits[i / 8] |= 0x80 >> (i % 8);
+		}
+		bpc = 0;
+	}
+
+	n = msr_synth_length (&sy, nbits);
+	s = malloc (n * sizeof (int16_t));
+	if (s == NULL)
+		errx (1, "Out of memory");
+	n = msr_synth_render (&sy, bits, nbits, s, n);
+	if (n == -1)
+		errx (1, "Out of memory");
+
+	if (check) {
+		i = decode (&sy, s, n, track, bpc);
+		free (s);
+		exit (i == -1);
+	}
+
+	f = fopen (argv[optind], "wb");
+	if (f == NULL)
+		err (1, "%s", argv[optind]);
+	wav_header (h, sy.msr_sy_rate, n);
+	if ((!rawfile && fwrite (h, sizeof (h), 1, f) != 1) ||
+	    write_samples (f, s, n) == -1 || fclose (f) == EOF)
+		err (1, "%s", argv[optind]);
+
+	free (s);
+
+	return (0);
+}
@@ -0,0 +1,348 @@
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "viterbi.h"
+
+/*
+ * Maximum likelihood Aiken biphase decoding.
+ *
+ * The streaming decoder reads each interval against the length of the
+ * last bit and decides on the spot. A spurious peak splits an interval
+ * in two, neither of which looks like anything, and the bits after it
+ * are read against a bad length or a bad phase until the decoder
+ * happens to fall back into step; a missed one does the same.
+ *
+ * Here every interval boundary is a column of a trellis. A state is
+ * where in the bit cell the last transition was (at the start of the
+ * cell, or in the middle of a one) and, with a character size, how
+ * far into the current character we are and its parity so far. Each
+ * way of reading the next one to MSR_VITERBI_MERGE intervals (as a
+ * zero, half of a one, or one of these with a transition missed, the
+ * intervals beyond the first being split off by noise) is a branch,
+ * costing the squared timing error, in bits, over twice
+ * msr_vt_sigma squared, plus a fixed cost for every peak that isn't
+ * one, every transition not seen and every character that fails
+ * parity. The cheapest path through the whole swipe is the most
+ * likely reading of it.
+ *
+ * The bit length isn't known beforehand and changes along a hand
+ * swipe, so each state carries the one its best path has arrived at,
+ * following each bit on that path by msr_vt_gain of the difference.
+ *
+ * Before the first character there are only clocking zeros, and after
+ * the last (the LRC) there are only zeros again; a character of all
+ * zeros is how the end is recognised. Where the first character
+ * starts is left open, so a swipe read backwards still lines up.
+ *
+ * The cost of a column depends only on the MSR_VITERBI_MERGE columns
+ * before it, so only those are kept, along with two bytes per state
+ * per column saying how it was reached. Work is linear in the number
+ * of intervals, with a constant factor of the number of states.
+ */
+
+/* Largest character size with a parity check. */
+#define MSR_VITERBI_MAXBPC	8
+
+/* Parity check states: before the track, after it, and in it. */
+#define PRE			0
+#define POST			1
+#define IN(pos, par, any)	(2 + ((pos) * 2 + (par)) * 2 + (any))
+#define MAXSTATES		(2 * IN (MSR_VITERBI_MAXBPC, 0, 0))
+
+/* An unreachable state. */
+#define NONE			1e300
+
+/* Cost of an interval that can't be read at all. */
+#define MSR_VITERBI_LOST	50
+
+/* How far behind the best path another may fall and still be followed. */
+#define MSR_VITERBI_BEAM	25
+
+/* Ways of reading the intervals up to the next transition. */
+static const struct reading {
+	int	from;		/* 1 if the last transition was mid one */
+	double	len;		/* Expected length, in bits */
+	int	to;
+	int	nbits;		/* Bits completed */
+	char	bits[2];
+	int	missing;	/* Transitions not seen */
+} readings[] = {
+	{ 0, 1.0, 0, 1, { '0' }, 0 },
+	{ 0, 0.5, 1, 0, { 0 }, 0 },
+	{ 1, 0.5, 0, 1, { '1' }, 0 },
+	{ 1, 1.0, 1, 1, { '1' }, 1 },
+	{ 0, 1.5, 1, 1, { '0' }, 1 },
+	{ 1, 1.5, 0, 2, { '1', '0' }, 1 },
+	{ 0, 2.0, 0, 2, { '0', '0' }, 1 }
+};
+#define NREADINGS	(sizeof (readings) / sizeof (readings[0]))
+
+/* Skipping an interval that makes no sense. */
+#define LOST		NREADINGS
+
+/*
+ * Reach state <to> of column i + <k> from state s of column i, through
+ * reading <r>, at cost <c> and with bit length <nl>, if that is the
+ * cheapest way there yet. The column's slot in cost[] and len[] is
+ * reused every MSR_VITERBI_MERGE + 1 columns; from[] has them all.
+ */
+
+#define RELAX(k, to, c, nl, r)						\
+	do {								\
+		slot = (i + (k)) % (MSR_VITERBI_MERGE + 1);		\
+		if ((c) < cost[slot][to]) {				\
+			cost[slot][to] = (c);				\
+			len[slot][to] = (nl);				\
+			from[(i + (k)) * ns + (to)] =			\
+			    s | (k) << 7 | (r) << 9;			\
+		}							\
+	} while (0)
+
+void
+msr_viterbi_init (msr_viterbi_t * vt)
+{
+	vt->msr_vt_from = NULL;
+	vt->msr_vt_size = 0;
+	vt->msr_vt_sigma = 0.1;
+	vt->msr_vt_gain = 0.25;
+	vt->msr_vt_spurious = 4;
+	vt->msr_vt_missing = 6;
+	vt->msr_vt_parity = 10;
+}
+
+void
+msr_viterbi_free (msr_viterbi_t * vt)
+{
+	free (vt->msr_vt_from);
+	vt->msr_vt_from = NULL;
+	vt->msr_vt_size = 0;
+}
+
+/*
+ * Move parity check state <q> on by <bit>. The states it may go to are
+ * stored in <next>, with their costs in <cost>; returns how many.
+ */
+
+static int
+advance (const msr_viterbi_t * vt, int bpc, int q, int bit, int * next,
+    double * cost)
+{
+	int pos, par, any;
+
+	cost[0] = 0;
+	if (bpc == 0) {
+		next[0] = 0;
+		return (1);
+	}
+
+	switch (q) {
+	case PRE:
+		/* Any bit may be the first of the first character. */
+		next[0] = IN (1, bit, bit);
+		if (bit)
+			return (1);
+		next[1] = PRE;
+		cost[1] = 0;
+		return (2);
+	case POST:
+		next[0] = POST;
+		if (bit)
+			cost[0] = vt->msr_vt_parity;
+		return (1);
+	}
+
+	q -= IN (0, 0, 0);
+	any = (q & 1) | bit;
+	par = (q >> 1 & 1) ^ bit;
+	pos = (q >> 2) + 1;
+
+	if (pos < bpc)
+		next[0] = IN (pos, par, any);
+	else if (!any)
+		next[0] = POST;
+	else {
+		next[0] = IN (0, 0, 0);
+		if (!par)
+			cost[0] = vt->msr_vt_parity;
+	}
+
+	return (1);
+}
+
+/* The median of up to nine intervals: the clocking bits' length. */
+static double
+initial (const int * iv, long count)
+{
+	int v[9], i, j, t, n = count < 9 ? (int)count : 9;
+
+	for (i = 0; i < n; i++) {
+		t = iv[i];
+		for (j = i; j > 0 && v[j - 1] > t; j--)
+			v[j] = v[j - 1];
+		v[j] = t;
+	}
+
+	return (v[n / 2]);
+}
+
+/*
+ * Decode a swipe
+ *
+ * This function finds the most likely bits behind the <count> peak
+ * intervals in <iv>, as found by msr_peaks_find(), and stores them as
+ * '0' and '1' characters in <bits>, which must have room for twice
+ * <count> characters. No terminating NUL is added. With <bpc> of 2 to
+ * 8, characters of that many bits are expected to have odd parity; 0
+ * turns the check off. As with the streaming decoder, the first two
+ * intervals are taken to be the head landing on the stripe.
+ *
+ * This function returns the number of bits stored. It will fail if
+ * <bpc> is out of range or memory can't be allocated.
+ */
+
+long
+msr_viterbi_decode (msr_viterbi_t * vt, const int * iv, long count,
+    int bpc, char * bits)
+{
+	double cost[MSR_VITERBI_MERGE + 1][MAXSTATES];
+	double len[MSR_VITERBI_MERGE + 1][MAXSTATES];
+	double c, t, d, x, w, best, pc[2], pc2[2];
+	const struct reading * r;
+	uint16_t * from;
+	long i, n, start = 2, end;
+	int ns, s, k, j, a, b, na, nb, slot, cur, to, q[2], q2[2];
+	char ch;
+
+	if (bpc != 0 && (bpc < 2 || bpc > MSR_VITERBI_MAXBPC))
+		return (-1);
+	if (count <= start)
+		return (0);
+
+	ns = 2 * (bpc ? IN (bpc, 0, 0) : 1);
+	if ((count + 1) * ns > vt->msr_vt_size) {
+		msr_viterbi_free (vt);
+		from = malloc ((count + 1) * ns * sizeof (uint16_t));
+		if (from == NULL)
+			return (-1);
+		vt->msr_vt_from = from;
+		vt->msr_vt_size = (count + 1) * ns;
+	}
+	from = vt->msr_vt_from;
+
+	for (j = 0; j <= MSR_VITERBI_MERGE; j++)
+		for (s = 0; s < ns; s++)
+			cost[j][s] = NONE;
+
+	/* Start among the clocking zeros, at a cell boundary. */
+	w = 2 * vt->msr_vt_sigma * vt->msr_vt_sigma;
+	slot = start % (MSR_VITERBI_MERGE + 1);
+	cost[slot][2 * PRE] = 0;
+	len[slot][2 * PRE] = initial (iv + start, count - start);
+
+	for (i = start; i < count; i++) {
+		/* The slot MSR_VITERBI_MERGE on is the column just done. */
+		if (i > start) {
+			slot = (i + MSR_VITERBI_MERGE) % (MSR_VITERBI_MERGE + 1);
+			for (s = 0; s < ns; s++)
+				cost[slot][s] = NONE;
+		}
+
+		/* Paths far behind the best will never catch up. */
+		cur = i % (MSR_VITERBI_MERGE + 1);
+		best = NONE;
+		for (s = 0; s < ns; s++)
+			if (cost[cur][s] < best)
+				best = cost[cur][s];
+
+		for (s = 0; s < ns; s++) {
+			c = cost[cur][s];
+			if (c > best + MSR_VITERBI_BEAM)
+				continue;
+			t = len[cur][s];
+
+			RELAX (1, s, c + MSR_VITERBI_LOST, t, (int)LOST);
+
+			x = 0;
+			for (k = 1; k <= MSR_VITERBI_MERGE && i + k <= count;
+			    k++) {
+				/* In bits, from here on. */
+				x += iv[i + k - 1] / t;
+				if (x > 2.5)
+					break;
+				for (j = 0; j < (int)NREADINGS; j++) {
+					r = &readings[j];
+					d = x - r->len;
+					if (r->from != (s & 1) || d > 0.5 || d < -0.5)
+						continue;
+					d = c + d * d / w +
+					    (k - 1) * vt->msr_vt_spurious +
+					    r->missing * vt->msr_vt_missing;
+
+					/* Through the parity check, bit by bit. */
+					if (r->nbits == 0) {
+						to = (s & ~1) | r->to;
+						RELAX (k, to, d, t + vt->msr_vt_gain *
+						    (x / r->len - 1) * t, j);
+						continue;
+					}
+					na = advance (vt, bpc, s >> 1,
+					    r->bits[0] == '1', q, pc);
+					for (a = 0; a < na; a++) {
+						nb = 1;
+						q2[0] = q[a];
+						pc2[0] = 0;
+						if (r->nbits == 2)
+							nb = advance (vt, bpc, q[a],
+							    r->bits[1] == '1', q2,
+							    pc2);
+						for (b = 0; b < nb; b++) {
+							to = 2 * q2[b] + r->to;
+							RELAX (k, to, d + pc[a] +
+							    pc2[b], t +
+							    vt->msr_vt_gain *
+							    (x / r->len - 1) * t, j);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/* The last interval may have been cut off; it can be left out. */
+	best = NONE;
+	end = count;
+	s = 0;
+	for (i = count - 1; i <= count; i++) {
+		slot = i % (MSR_VITERBI_MERGE + 1);
+		for (j = 0; j < ns; j++)
+			if (cost[slot][j] < best) {
+				best = cost[slot][j];
+				end = i;
+				s = j;
+			}
+	}
+	if (best == NONE)
+		return (0);
+
+	/* Follow the path back, then turn the bits round. */
+	for (i = end, n = 0; i > start; i -= k) {
+		j = from[i * ns + s] >> 9;
+		k = from[i * ns + s] >> 7 & 3;
+		s = from[i * ns + s] & 0x7f;
+		if (j == (int)LOST)
+			continue;
+		for (a = readings[j].nbits - 1; a >= 0; a--)
+			bits[n++] = readings[j].bits[a];
+	}
+	for (i = 0; i < n / 2; i++) {
+		ch = bits[i];
+		bits[i] = bits[n - 1 - i];
+		bits[n - 1 - i] = ch;
+	}
+
+	return (n);
+}
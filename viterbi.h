@@ -0,0 +1,35 @@
+#ifndef _VITERBI_H_
+#define _VITERBI_H_
+
+/*
+ * Maximum likelihood Aiken biphase decoding.
+ *
+ * Where the streaming decoder settles each bit as soon as it has seen
+ * an interval or two, this one takes the peak intervals of a whole
+ * swipe, weighs every way of reading them as bits (with peaks that
+ * shouldn't be there, and peaks that should but aren't), and keeps
+ * the most likely. With a character size, the odd parity of ABA and
+ * IATA characters counts towards the likelihood as well.
+ *
+ * A decoder's storage is kept from swipe to swipe.
+ */
+
+/* Most intervals one bit cell can be made of: the rest were noise. */
+#define MSR_VITERBI_MERGE	3
+
+typedef struct msr_viterbi {
+	uint16_t *	msr_vt_from;	/* How each state was reached */
+	long		msr_vt_size;	/* Room in msr_vt_from */
+	double		msr_vt_sigma;	/* Timing deviation (fraction of a bit) */
+	double		msr_vt_gain;	/* How fast the bit length follows */
+	double		msr_vt_spurious; /* Cost of a peak that isn't one */
+	double		msr_vt_missing;	/* ... of a transition not seen */
+	double		msr_vt_parity;	/* ... of a character failing parity */
+} msr_viterbi_t;
+
+extern void msr_viterbi_init (msr_viterbi_t *);
+extern void msr_viterbi_free (msr_viterbi_t *);
+extern long msr_viterbi_decode (msr_viterbi_t *, const int *, long, int,
+    char *);
+
+#endif /* _VITERBI_H_ */